@@ -25,6 +25,22 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Image aliases, read from ~/.fsurc:
+ *	name:path:fstype[:mntopts[:puffsexec]]
+ *
+ * The file is compiled into ~/.fsurc.db, which is mapped by the next
+ * runs and looked up through its hash table without parsing anything:
+ *
+ *	struct aliasdb_hdr	magic, identity of the .fsurc compiled
+ *	uint32_t[ah_nbuckets]	first entry of each chain, index + 1
+ *	struct aliasdb_ent[]	the aliases
+ *	char[ah_strsize]	their strings, offset 0 is the empty one
+ *
+ * The database is compiled again when .fsurc changes.  When it cannot
+ * be written, .fsurc is parsed on each run as before.
+ */
+
 #include "fs-utils.h"
 
 #if defined(__NetBSD__)
@@ -35,27 +51,72 @@
 #define PATH_MAX (1024)
 #endif
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #if HAVE_NBCOMPAT_H
 #include <nbcompat.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <fsu_utils.h>
 
 #include "fsu_alias.h"
 
+#define ALIAS_RC	"/.fsurc"
+#define ALIAS_DB	"/.fsurc.db"
+
+#define ALIASDB_MAGIC	"FSUALDB1"
+#define ALIASDB_ORDER	0x01020304	/* written in host byte order */
+
+enum { AE_NAME, AE_PATH, AE_TYPE, AE_MNTOPT, AE_PUFFSEXEC, AE_NSTR };
+
+struct aliasdb_hdr {
+	char		ah_magic[8];
+	uint32_t	ah_order;
+	uint32_t	ah_nbuckets;	/* power of 2 */
+	uint32_t	ah_nentries;
+	uint32_t	ah_strsize;
+	uint64_t	ah_dev;		/* .fsurc compiled */
+	uint64_t	ah_ino;
+	int64_t		ah_size;
+	int64_t		ah_mtime;
+};
+
+struct aliasdb_ent {
+	uint32_t	ae_hash;
+	uint32_t	ae_next;	/* next entry of the chain, index + 1 */
+	uint32_t	ae_str[AE_NSTR];
+};
+
 static struct fsu_fsalias_s *alias_head, *alias_tail;
 
+/* mapped database */
+static void *alias_db;
+static size_t alias_dblen;
+static struct fsu_fsalias_s alias_found;
+
+static int alias_files(char *, char *, size_t);
+static uint32_t alias_hash(const char *);
+static int alias_map(const char *, const struct stat *);
+static int alias_parse(const char *);
+static int alias_write(const char *, const struct stat *);
+static struct fsu_fsalias_s *alias_lookup(const char *);
+
 struct fsu_fsalias_s
 *get_alias(const char *al)
 {
 	struct fsu_fsalias_s *cur;
 
+	if (alias_db != NULL)
+		return alias_lookup(al);
+
 	for (cur = alias_head; cur != NULL; cur = cur->fsa_next)
 		if (cur->fsa_name != NULL && strcmp(cur->fsa_name, al) == 0)
 			return cur;
@@ -66,21 +127,304 @@ int
 build_alias_list(void)
 {
 	struct stat sb;
+	char rc[PATH_MAX + 1], db[PATH_MAX + 1];
+	int rv;
+
+	if (alias_files(rc, db, sizeof(rc)) == -1)
+		return -1;
+
+	/* no file no alias loaded */
+	if (stat(rc, &sb) != 0)
+		return -1;
+
+	if (alias_map(db, &sb) == 0)
+		return 0;
+
+	/* missing or out of date, this run uses the list just parsed */
+	rv = alias_parse(rc);
+	if (rv == 0)
+		alias_write(db, &sb);
+	return rv;
+}
+
+/*
+ * Compiles ~/.fsurc into ~/.fsurc.db now, for fsu_alias(1).
+ */
+int
+fsu_alias_compile(void)
+{
+	struct stat sb;
+	char rc[PATH_MAX + 1], db[PATH_MAX + 1];
+	int rv;
+
+	if (alias_files(rc, db, sizeof(rc)) == -1) {
+		warnx("HOME is not set");
+		return -1;
+	}
+	if (stat(rc, &sb) != 0) {
+		warn("%s", rc);
+		return -1;
+	}
+
+	rv = alias_parse(rc);
+	if (rv == 0 && alias_write(db, &sb) == -1) {
+		warn("%s", db);
+		rv = -1;
+	}
+	free_alias_list();
+	return rv;
+}
+
+static int
+alias_files(char *rc, char *db, size_t len)
+{
+	const char *home;
+
+	home = getenv("HOME");
+	if (home == NULL)
+		return -1;
+
+	if ((size_t)snprintf(rc, len, "%s" ALIAS_RC, home) >= len ||
+	    (size_t)snprintf(db, len, "%s" ALIAS_DB, home) >= len)
+		return -1;
+	return 0;
+}
+
+/* FNV-1a */
+static uint32_t
+alias_hash(const char *s)
+{
+	uint32_t h;
+
+	for (h = 2166136261U; *s != '\0'; ++s)
+		h = (h ^ (unsigned char)*s) * 16777619U;
+	return h;
+}
+
+/*
+ * Maps the database if it was compiled from rc as it is now.
+ */
+static int
+alias_map(const char *db, const struct stat *rsb)
+{
+	const struct aliasdb_hdr *hdr;
+	const char *strs;
+	struct stat sb;
+	uint64_t len;
+	void *p;
+	int fd;
+
+	fd = open(db, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &sb) == -1 ||
+	    (size_t)sb.st_size < sizeof(struct aliasdb_hdr)) {
+		close(fd);
+		return -1;
+	}
+	/* private and writable, as the strings of the list are */
+	p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+
+	hdr = p;
+	len = sizeof(*hdr) + (uint64_t)hdr->ah_nbuckets * sizeof(uint32_t) +
+	    (uint64_t)hdr->ah_nentries * sizeof(struct aliasdb_ent) +
+	    hdr->ah_strsize;
+	if (memcmp(hdr->ah_magic, ALIASDB_MAGIC, sizeof(hdr->ah_magic)) != 0 ||
+	    hdr->ah_order != ALIASDB_ORDER ||
+	    hdr->ah_nbuckets == 0 ||
+	    (hdr->ah_nbuckets & (hdr->ah_nbuckets - 1)) != 0 ||
+	    hdr->ah_strsize == 0 || len != (uint64_t)sb.st_size) {
+		munmap(p, sb.st_size);
+		return -1;
+	}
+
+	strs = (const char *)p + sb.st_size - hdr->ah_strsize;
+	if (strs[hdr->ah_strsize - 1] != '\0' ||
+	    hdr->ah_dev != (uint64_t)rsb->st_dev ||
+	    hdr->ah_ino != (uint64_t)rsb->st_ino ||
+	    hdr->ah_size != (int64_t)rsb->st_size ||
+	    hdr->ah_mtime != (int64_t)rsb->st_mtime) {
+		munmap(p, sb.st_size);
+		return -1;
+	}
+
+	alias_db = p;
+	alias_dblen = sb.st_size;
+	return 0;
+}
+
+static struct fsu_fsalias_s *
+alias_lookup(const char *al)
+{
+	const struct aliasdb_hdr *hdr;
+	const struct aliasdb_ent *ents, *e;
+	const uint32_t *buckets;
+	const char *strs;
+	char *str[AE_NSTR];
+	uint32_t h, i, n;
+	int j;
+
+	hdr = alias_db;
+	buckets = (const uint32_t *)(hdr + 1);
+	ents = (const struct aliasdb_ent *)(buckets + hdr->ah_nbuckets);
+	strs = (const char *)(ents + hdr->ah_nentries);
+
+	h = alias_hash(al);
+	i = buckets[h & (hdr->ah_nbuckets - 1)];
+	for (n = 0; i != 0 && i <= hdr->ah_nentries &&
+	    n < hdr->ah_nentries; ++n, i = e->ae_next) {
+		e = &ents[i - 1];
+		if (e->ae_hash != h)
+			continue;
+
+		for (j = 0; j < AE_NSTR; ++j) {
+			if (e->ae_str[j] == 0 ||
+			    e->ae_str[j] >= hdr->ah_strsize)
+				str[j] = NULL;
+			else
+				str[j] = (char *)(uintptr_t)
+				    (strs + e->ae_str[j]);
+		}
+		if (str[AE_NAME] == NULL || str[AE_PATH] == NULL ||
+		    str[AE_TYPE] == NULL || strcmp(str[AE_NAME], al) != 0)
+			continue;
+
+		alias_found.fsa_name = str[AE_NAME];
+		alias_found.fsa_path = str[AE_PATH];
+		alias_found.fsa_type = str[AE_TYPE];
+		alias_found.fsa_mntopt = str[AE_MNTOPT];
+		alias_found.fsa_puffsexec = str[AE_PUFFSEXEC];
+		alias_found.fsa_next = NULL;
+		return &alias_found;
+	}
+	return NULL;
+}
+
+/*
+ * Writes the aliases parsed from rc to the database, the first of
+ * several with the same name wins as it does in the list.
+ */
+static int
+alias_write(const char *db, const struct stat *rsb)
+{
+	struct aliasdb_hdr hdr;
+	struct aliasdb_ent *ents, *e;
+	struct fsu_fsalias_s *cur;
+	uint32_t *buckets, nb, n, i, h;
+	char *strs, *str[AE_NSTR], tmp[PATH_MAX + 1];
+	size_t strsize, off, len;
+	FILE *fp;
+	int fd, j, rv;
+
+	n = 0;
+	strsize = 1;
+	for (cur = alias_head; cur != NULL; cur = cur->fsa_next) {
+		++n;
+		strsize += strlen(cur->fsa_name) + strlen(cur->fsa_path) +
+		    strlen(cur->fsa_type) + 3;
+		if (cur->fsa_mntopt != NULL)
+			strsize += strlen(cur->fsa_mntopt) + 1;
+		if (cur->fsa_puffsexec != NULL)
+			strsize += strlen(cur->fsa_puffsexec) + 1;
+	}
+	if (strsize > UINT32_MAX || n > UINT32_MAX / 4) {
+		errno = EFBIG;
+		return -1;
+	}
+	for (nb = 1; nb < 2 * n; nb <<= 1)
+		continue;
+
+	buckets = calloc(nb, sizeof(*buckets));
+	ents = calloc(n + 1, sizeof(*ents));
+	strs = malloc(strsize);
+	if (buckets == NULL || ents == NULL || strs == NULL) {
+		rv = -1;
+		goto out;
+	}
+
+	strs[0] = '\0';
+	off = 1;
+	i = 0;
+	for (cur = alias_head; cur != NULL; cur = cur->fsa_next) {
+		h = alias_hash(cur->fsa_name);
+		for (j = buckets[h & (nb - 1)]; j != 0; j = ents[j - 1].ae_next)
+			if (strcmp(strs + ents[j - 1].ae_str[AE_NAME],
+			    cur->fsa_name) == 0)
+				break;
+		if (j != 0)
+			continue;
+
+		e = &ents[i];
+		e->ae_hash = h;
+		str[AE_NAME] = cur->fsa_name;
+		str[AE_PATH] = cur->fsa_path;
+		str[AE_TYPE] = cur->fsa_type;
+		str[AE_MNTOPT] = cur->fsa_mntopt;
+		str[AE_PUFFSEXEC] = cur->fsa_puffsexec;
+		for (j = 0; j < AE_NSTR; ++j) {
+			if (str[j] == NULL)
+				continue;
+			len = strlen(str[j]) + 1;
+			memcpy(strs + off, str[j], len);
+			e->ae_str[j] = off;
+			off += len;
+		}
+		e->ae_next = buckets[h & (nb - 1)];
+		buckets[h & (nb - 1)] = ++i;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.ah_magic, ALIASDB_MAGIC, sizeof(hdr.ah_magic));
+	hdr.ah_order = ALIASDB_ORDER;
+	hdr.ah_nbuckets = nb;
+	hdr.ah_nentries = i;
+	hdr.ah_strsize = off;
+	hdr.ah_dev = rsb->st_dev;
+	hdr.ah_ino = rsb->st_ino;
+	hdr.ah_size = rsb->st_size;
+	hdr.ah_mtime = rsb->st_mtime;
+
+	/* replace the database in one go */
+	rv = -1;
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", db) >= sizeof(tmp))
+		goto out;
+	if ((fd = mkstemp(tmp)) == -1)
+		goto out;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(buckets, sizeof(*buckets), nb, fp);
+	fwrite(ents, sizeof(*ents), i, fp);
+	fwrite(strs, 1, off, fp);
+	rv = ferror(fp) ? -1 : 0;
+	if (fclose(fp) != 0 || (rv == 0 && rename(tmp, db) == -1))
+		rv = -1;
+	if (rv == -1)
+		unlink(tmp);
+
+out:
+	free(buckets);
+	free(ents);
+	free(strs);
+	return rv;
+}
+
+static int
+alias_parse(const char *file)
+{
 	struct fsu_fsalias_s *new;
 	FILE *fd;
 	int i, rv;
 	size_t len, off;
-	char buf[8192], file[PATH_MAX + 1], *fp, *home;
+	char buf[8192], *fp, *home;
 
-	fp = getenv("HOME");
-	if (fp == NULL)
-		return -1;
-
-	strlcpy(file, fp, PATH_MAX + 1);
-	strlcat(file, "/.fsurc", PATH_MAX + 1);
-
-	/* no file no alias loaded */
-	if (stat(file, &sb) != 0 || (fd = fopen(file, "r")) == NULL)
+	if ((fd = fopen(file, "r")) == NULL)
 		return -1;
 
 	rv = 0;
@@ -185,6 +529,11 @@ free_alias_list(void)
 {
 	struct fsu_fsalias_s *cur;
 
+	if (alias_db != NULL) {
+		munmap(alias_db, alias_dblen);
+		alias_db = NULL;
+	}
+
 	while ((cur = alias_head) != NULL) {
 		alias_head = alias_head->fsa_next;
 		free(cur->fsa_name);
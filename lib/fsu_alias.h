@@ -39,4 +39,5 @@ struct fsu_fsalias_s {
 int build_alias_list(void);
 void free_alias_list(void);
 struct fsu_fsalias_s *get_alias(const char *);
+int fsu_alias_compile(void);
 #endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * fsu_mount() replacement for utilities built as rump kernel clients.
+ * The image is mounted once by fsu_session and every utility attaches
+ * to it over the socket given in FSU_SESSION.
+ */
+
+#include "fs-utils.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rump/rumpclient.h>
+#include <rump/rump_syscalls.h>
+
+#include "fsu_mount.h"
+#include "fsu_trace.h"
+
+#define MOUNT_DIRECTORY "/mnt"
+
+static bool attached;
+
+struct fsu_ctx {
+	int	fc_unused;
+};
+
+/*
+ * Connects to the session server and chroots the client process to the
+ * mounted image.  The mount arguments are left to the server, so none
+ * are removed from argv.  With MOUNT_DEFER the connection waits for
+ * fsu_mount_now().
+ */
+int
+fsu_mount(int *argc, char **argv[], int mode)
+{
+
+	if (mode & MOUNT_DEFER)
+		return 0;
+	return fsu_mount_now();
+}
+
+int
+fsu_mount_now(void)
+{
+	struct timespec ts;
+	char *session;
+	int rv;
+
+	if (attached)
+		return 0;
+
+	session = getenv("FSU_SESSION");
+	if (session == NULL) {
+		warnx("FSU_SESSION is not set, start fsu_session first");
+		return -1;
+	}
+
+	if (setenv("RUMP_SERVER", session, 1) == -1) {
+		warn(NULL);
+		return -1;
+	}
+
+	fsu_trace_start(&ts);
+	rv = rumpclient_init();
+	fsu_trace_end(&ts, "rumpclient_init", NULL, rv == 0 ? 0 : errno);
+	if (rv == -1) {
+		warn("%s", session);
+		return -1;
+	}
+
+	if (rump_sys_chroot(MOUNT_DIRECTORY) == -1) {
+		warn("%s: chroot", session);
+		return -1;
+	}
+	attached = true;
+	return 0;
+}
+
+void
+fsu_unmount(void)
+{
+
+	/* the server owns the mount */
+}
+
+/*
+ * The server gives every thread of the client an lwp of its own in the
+ * chrooted process, there is nothing to set up.
+ */
+struct fsu_ctx *
+fsu_ctx_open(void)
+{
+
+	if (!attached) {
+		errno = ENXIO;
+		return NULL;
+	}
+	return calloc(1, sizeof(struct fsu_ctx));
+}
+
+/*
+ * The client is a single process of the server, which cannot be forked
+ * from here; the caller runs in it like any other thread.
+ */
+struct fsu_ctx *
+fsu_proc_open(void)
+{
+
+	return fsu_ctx_open();
+}
+
+void
+fsu_ctx_close(struct fsu_ctx *ctx)
+{
+
+	free(ctx);
+}
+
+const char *
+fsu_mount_usage(void)
+{
+
+	return "";
+}
@@ -0,0 +1,634 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Block cache for the image, enabled with FSU_CACHE_MB=<size in MiB>.
+ *
+ * The image is cached in lines of BC_LINE bytes, found through a hash
+ * of (fd, line number) and evicted with the CLOCK algorithm.  A read
+ * that misses right where the previous read of the same fd ended
+ * counts as sequential: the number of lines read ahead with it doubles
+ * up to BC_RA_MAX, and drops back to none on a random miss.
+ *
+ * Writes are absorbed into the lines and kept as one dirty range per
+ * line, so that the many small writes to a metadata block reach the
+ * image as a single pwrite.  Dirty lines are written back when they are
+ * evicted, before a synchronous write completes (so that the file
+ * system ordering holds), when the image is closed and when the
+ * program exits, after fsu_unmount().  Lines that fail to be written
+ * back stay dirty, and the image stays open for bc_exit() to try again.
+ *
+ * bc_mtx is not held while on the host: a line being read or written
+ * back is marked busy, and whoever needs it waits on bc_cv for it to be
+ * done, then looks it up again.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#define BC_LINE		(64 * 1024)
+#define BC_RA_MAX	32		/* lines read ahead at most */
+#define BC_STREAMS	4		/* images tracked for readahead */
+
+struct bc_line {
+	struct bc_line	*bl_next;	/* hash chain */
+	uint8_t		*bl_data;
+	int64_t		bl_blk;		/* line number, -1 when free */
+	int		bl_fd;
+	size_t		bl_len;		/* bytes present in the image */
+	size_t		bl_dlo;		/* dirty range */
+	size_t		bl_dhi;
+	bool		bl_valid;	/* bl_data holds the image data */
+	bool		bl_ref;		/* used since the hand went by */
+	bool		bl_busy;	/* I/O in progress, without bc_mtx */
+};
+
+struct bc_stream {
+	int		bs_fd;
+	int64_t		bs_next;	/* where a sequential read starts */
+	int		bs_ra;		/* lines to read ahead */
+};
+
+static pthread_mutex_t bc_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bc_cv = PTHREAD_COND_INITIALIZER;
+static struct bc_line *bc_lines;
+static struct bc_line **bc_hash;
+static size_t bc_nlines, bc_hand;
+static struct bc_stream bc_streams[BC_STREAMS];
+
+static size_t		bc_hashidx(int, int64_t);
+static struct bc_line	*bc_lookup(int, int64_t);
+static struct bc_line	*bc_alloc(int, int64_t, bool);
+static void		bc_unhash(struct bc_line *);
+static void		bc_unbusy(struct bc_line *);
+static int		bc_writeback(struct bc_line *);
+static int		bc_fill(struct bc_line *);
+static int		bc_readahead(int, int64_t, int);
+static int		bc_read(int, uint8_t *, size_t, int64_t, size_t *);
+static int		bc_write(int, const uint8_t *, size_t, int64_t, bool,
+			    size_t *);
+static int		bc_flush(int);
+static void		bc_exit(void);
+
+int
+fsu_bcache_init(void)
+{
+	const char *env;
+	char *ep;
+	unsigned long mb;
+	size_t i;
+
+	env = getenv("FSU_CACHE_MB");
+	if (env == NULL || env[0] == '\0')
+		return -1;
+
+	errno = 0;
+	mb = strtoul(env, &ep, 10);
+	if (errno != 0 || *ep != '\0' || mb == 0) {
+		warnx("FSU_CACHE_MB: %s: invalid size", env);
+		return -1;
+	}
+
+	bc_nlines = mb * (1024 * 1024 / BC_LINE);
+	bc_lines = calloc(bc_nlines, sizeof(*bc_lines));
+	bc_hash = calloc(bc_nlines, sizeof(*bc_hash));
+	if (bc_lines == NULL || bc_hash == NULL)
+		goto fail;
+
+	for (i = 0; i < bc_nlines; ++i) {
+		bc_lines[i].bl_data = malloc(BC_LINE);
+		if (bc_lines[i].bl_data == NULL)
+			goto fail;
+		bc_lines[i].bl_blk = -1;
+	}
+	for (i = 0; i < BC_STREAMS; ++i)
+		bc_streams[i].bs_fd = -1;
+
+	/* registered before fsu_unmount(), so it runs after it */
+	if (atexit(bc_exit) != 0)
+		goto fail;
+	return 0;
+
+ fail:
+	warn("FSU_CACHE_MB");
+	if (bc_lines != NULL)
+		for (i = 0; i < bc_nlines; ++i)
+			free(bc_lines[i].bl_data);
+	free(bc_lines);
+	free(bc_hash);
+	return -1;
+}
+
+int
+fsu_bcache_io(int fd, int op, void *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	int error;
+
+	*done = 0;
+	if (off < 0)
+		return EINVAL;
+
+	pthread_mutex_lock(&bc_mtx);
+	if (op & RUMPUSER_BIO_WRITE)
+		error = bc_write(fd, data, dlen, off,
+		    (op & RUMPUSER_BIO_SYNC) != 0, done);
+	else
+		error = bc_read(fd, data, dlen, off, done);
+	pthread_mutex_unlock(&bc_mtx);
+
+	return error;
+}
+
+/*
+ * Writes back and drops the lines of fd.  Returns the error of the write
+ * back, in which case the dirty lines are kept and fd must stay open.
+ */
+int
+fsu_bcache_close(int fd)
+{
+	struct bc_line *bl;
+	size_t i;
+	int error;
+
+	pthread_mutex_lock(&bc_mtx);
+	error = bc_flush(fd);
+	for (i = 0; i < bc_nlines; ++i) {
+		bl = &bc_lines[i];
+		while (bl->bl_busy)
+			pthread_cond_wait(&bc_cv, &bc_mtx);
+		if (bl->bl_blk != -1 && bl->bl_fd == fd &&
+		    bl->bl_dlo == bl->bl_dhi)
+			bc_unhash(bl);
+	}
+	for (i = 0; i < BC_STREAMS; ++i)
+		if (bc_streams[i].bs_fd == fd)
+			bc_streams[i].bs_fd = -1;
+	pthread_mutex_unlock(&bc_mtx);
+
+	if (error != 0) {
+		errno = error;
+		warn("block cache write back failed, keeping the image open");
+	}
+	return error;
+}
+
+static size_t
+bc_hashidx(int fd, int64_t blk)
+{
+
+	return ((uint64_t)blk * 0x9e3779b97f4a7c15ULL + fd) % bc_nlines;
+}
+
+static struct bc_line *
+bc_lookup(int fd, int64_t blk)
+{
+	struct bc_line *bl;
+
+	for (bl = bc_hash[bc_hashidx(fd, blk)]; bl != NULL; bl = bl->bl_next)
+		if (bl->bl_blk == blk && bl->bl_fd == fd)
+			return bl;
+	return NULL;
+}
+
+static void
+bc_unhash(struct bc_line *bl)
+{
+	struct bc_line **blp;
+
+	for (blp = &bc_hash[bc_hashidx(bl->bl_fd, bl->bl_blk)]; *blp != bl;
+	    blp = &(*blp)->bl_next)
+		continue;
+	*blp = bl->bl_next;
+	bl->bl_blk = -1;
+}
+
+static void
+bc_unbusy(struct bc_line *bl)
+{
+
+	bl->bl_busy = false;
+	pthread_cond_broadcast(&bc_cv);
+}
+
+/*
+ * Takes a line for (fd, blk) from the CLOCK hand, writing back the
+ * dirty lines on the way.  Returns NULL with errno set if a write back
+ * failed, to EEXIST if another thread brought blk in meanwhile, or to
+ * EBUSY if every line is busy and the caller, holding busy lines of its
+ * own, cannot wait.
+ */
+static struct bc_line *
+bc_alloc(int fd, int64_t blk, bool canwait)
+{
+	struct bc_line *bl;
+	size_t idx, busy;
+	bool unlocked;
+	int error;
+
+	unlocked = false;
+	for (busy = 0;;) {
+		bl = &bc_lines[bc_hand];
+		bc_hand = (bc_hand + 1) % bc_nlines;
+		if (bl->bl_busy) {
+			/* every line busy, wait for one */
+			if (++busy == bc_nlines) {
+				if (!canwait) {
+					errno = EBUSY;
+					return NULL;
+				}
+				pthread_cond_wait(&bc_cv, &bc_mtx);
+				unlocked = true;
+				busy = 0;
+			}
+			continue;
+		}
+		busy = 0;
+		if (bl->bl_blk == -1)
+			break;
+		if (bl->bl_ref) {
+			bl->bl_ref = false;
+			continue;
+		}
+		if (bl->bl_dlo < bl->bl_dhi) {
+			/* clean, it is taken when the hand comes back */
+			if ((error = bc_writeback(bl)) != 0) {
+				errno = error;
+				return NULL;
+			}
+			unlocked = true;
+			continue;
+		}
+		bc_unhash(bl);
+		break;
+	}
+
+	if (unlocked && bc_lookup(fd, blk) != NULL) {
+		errno = EEXIST;
+		return NULL;
+	}
+
+	bl->bl_fd = fd;
+	bl->bl_blk = blk;
+	bl->bl_len = 0;
+	bl->bl_dlo = bl->bl_dhi = 0;
+	bl->bl_valid = false;
+	bl->bl_ref = true;
+	idx = bc_hashidx(fd, blk);
+	bl->bl_next = bc_hash[idx];
+	bc_hash[idx] = bl;
+	return bl;
+}
+
+/*
+ * Writes back the dirty range of a line, without bc_mtx.  The range is
+ * left dirty if the write fails.
+ */
+static int
+bc_writeback(struct bc_line *bl)
+{
+	size_t lo;
+	ssize_t n;
+	int error;
+
+	if (bl->bl_dlo == bl->bl_dhi)
+		return 0;
+
+	bl->bl_busy = true;
+	pthread_mutex_unlock(&bc_mtx);
+	error = 0;
+	for (lo = bl->bl_dlo; lo < bl->bl_dhi; lo += n) {
+		n = pwrite(bl->bl_fd, bl->bl_data + lo, bl->bl_dhi - lo,
+		    (off_t)bl->bl_blk * BC_LINE + lo);
+		if (n == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			error = errno;
+			break;
+		}
+		if (n == 0) {
+			error = EIO;
+			break;
+		}
+	}
+	pthread_mutex_lock(&bc_mtx);
+	if (error == 0)
+		bl->bl_dlo = bl->bl_dhi = 0;
+	bc_unbusy(bl);
+	return error;
+}
+
+/*
+ * Reads the image data of a line around the dirty range it holds.
+ */
+static int
+bc_fill(struct bc_line *bl)
+{
+	uint8_t *buf;
+	ssize_t n;
+	int error;
+
+	if ((buf = malloc(BC_LINE)) == NULL)
+		return errno;
+
+	bl->bl_busy = true;
+	pthread_mutex_unlock(&bc_mtx);
+	do
+		n = pread(bl->bl_fd, buf, BC_LINE,
+		    (off_t)bl->bl_blk * BC_LINE);
+	while (n == -1 && errno == EINTR);
+	if (n == -1) {
+		error = errno;
+		pthread_mutex_lock(&bc_mtx);
+		bc_unbusy(bl);
+		free(buf);
+		return error;
+	}
+
+	if (bl->bl_dlo == bl->bl_dhi)
+		memcpy(bl->bl_data, buf, n);
+	else {
+		memcpy(bl->bl_data, buf, MIN((size_t)n, bl->bl_dlo));
+		/* written past the end of the image */
+		if ((size_t)n < bl->bl_dlo)
+			memset(bl->bl_data + n, 0, bl->bl_dlo - n);
+		if ((size_t)n > bl->bl_dhi)
+			memcpy(bl->bl_data + bl->bl_dhi,
+			    buf + bl->bl_dhi, n - bl->bl_dhi);
+	}
+	bl->bl_len = MAX((size_t)n, bl->bl_dhi);
+	bl->bl_valid = true;
+	pthread_mutex_lock(&bc_mtx);
+	bc_unbusy(bl);
+	free(buf);
+	return 0;
+}
+
+/*
+ * Brings in line blk and up to ra lines after it with one preadv, stopping
+ * at the first line already cached.  Returns EEXIST if another thread
+ * brought blk in meanwhile.
+ */
+static int
+bc_readahead(int fd, int64_t blk, int ra)
+{
+	struct bc_line *lines[BC_RA_MAX + 1];
+	struct iovec iov[BC_RA_MAX + 1];
+	ssize_t n;
+	int i, cnt, error;
+
+	if ((size_t)ra > bc_nlines / 4)
+		ra = bc_nlines / 4;
+
+	for (cnt = 0; cnt <= ra; ++cnt) {
+		if (cnt > 0 && bc_lookup(fd, blk + cnt) != NULL)
+			break;
+		lines[cnt] = bc_alloc(fd, blk + cnt, cnt == 0);
+		if (lines[cnt] == NULL) {
+			if (cnt == 0)
+				return errno;
+			break;
+		}
+		/* hidden from the others until read */
+		lines[cnt]->bl_busy = true;
+		iov[cnt].iov_base = lines[cnt]->bl_data;
+		iov[cnt].iov_len = BC_LINE;
+	}
+
+	pthread_mutex_unlock(&bc_mtx);
+	do
+		n = preadv(fd, iov, cnt, (off_t)blk * BC_LINE);
+	while (n == -1 && errno == EINTR);
+	error = n == -1 ? errno : 0;
+	pthread_mutex_lock(&bc_mtx);
+
+	for (i = 0; i < cnt; ++i) {
+		if (error != 0)
+			bc_unhash(lines[i]);
+		else {
+			lines[i]->bl_len = MIN((size_t)n, BC_LINE);
+			lines[i]->bl_valid = true;
+			n -= lines[i]->bl_len;
+		}
+		bc_unbusy(lines[i]);
+	}
+	return error;
+}
+
+static int
+bc_read(int fd, uint8_t *data, size_t dlen, int64_t off, size_t *done)
+{
+	struct bc_stream *bs;
+	struct bc_line *bl;
+	int64_t blk;
+	size_t boff, len;
+	int error, i;
+
+	/* the readahead state of this image */
+	for (bs = NULL, i = 0; i < BC_STREAMS; ++i) {
+		if (bc_streams[i].bs_fd == fd) {
+			bs = &bc_streams[i];
+			break;
+		}
+		if (bs == NULL && bc_streams[i].bs_fd == -1)
+			bs = &bc_streams[i];
+	}
+	if (bs == NULL)
+		bs = &bc_streams[fd % BC_STREAMS];
+	if (bs->bs_fd != fd) {
+		bs->bs_fd = fd;
+		bs->bs_next = -1;
+		bs->bs_ra = 0;
+	}
+
+	while (dlen > 0) {
+		blk = off / BC_LINE;
+		boff = off % BC_LINE;
+		len = MIN(dlen, BC_LINE - boff);
+
+		/* after each trip to the host, look the line up again */
+		bl = bc_lookup(fd, blk);
+		if (bl != NULL && bl->bl_busy) {
+			pthread_cond_wait(&bc_cv, &bc_mtx);
+			continue;
+		}
+		if (bl == NULL) {
+			if (off == bs->bs_next)
+				bs->bs_ra = bs->bs_ra == 0 ? 1 :
+				    MIN(bs->bs_ra * 2, BC_RA_MAX);
+			else
+				bs->bs_ra = 0;
+			error = bc_readahead(fd, blk, bs->bs_ra);
+			if (error != 0 && error != EEXIST)
+				return error;
+			continue;
+		}
+		if (!bl->bl_valid &&
+		    (boff < bl->bl_dlo || boff + len > bl->bl_dhi)) {
+			/* written but never read, outside what was written */
+			error = bc_fill(bl);
+			if (error != 0)
+				return error;
+			continue;
+		}
+		bl->bl_ref = true;
+
+		/* short read at the end of the image */
+		if (bl->bl_valid) {
+			if (boff >= bl->bl_len)
+				break;
+			len = MIN(len, bl->bl_len - boff);
+		}
+		memcpy(data, bl->bl_data + boff, len);
+
+		data += len;
+		dlen -= len;
+		off += len;
+		*done += len;
+		bs->bs_next = off;
+		if (bl->bl_valid && bl->bl_len < BC_LINE)
+			break;
+	}
+	return 0;
+}
+
+static int
+bc_write(int fd, const uint8_t *data, size_t dlen, int64_t off, bool sync,
+    size_t *done)
+{
+	struct bc_line *bl;
+	int64_t blk;
+	size_t boff, len;
+	int error;
+
+	while (dlen > 0) {
+		blk = off / BC_LINE;
+		boff = off % BC_LINE;
+		len = MIN(dlen, BC_LINE - boff);
+
+		bl = bc_lookup(fd, blk);
+		if (bl != NULL && bl->bl_busy) {
+			pthread_cond_wait(&bc_cv, &bc_mtx);
+			continue;
+		}
+		if (bl == NULL && (bl = bc_alloc(fd, blk, true)) == NULL) {
+			if (errno == EEXIST)
+				continue;
+			return errno;
+		}
+
+		/*
+		 * A line that was never read can only hold one dirty range
+		 * of image data, fill it if this write leaves a hole.
+		 */
+		if (!bl->bl_valid && bl->bl_dlo < bl->bl_dhi &&
+		    (boff + len < bl->bl_dlo || boff > bl->bl_dhi)) {
+			error = bc_fill(bl);
+			if (error != 0)
+				return error;
+			continue;
+		}
+
+		memcpy(bl->bl_data + boff, data, len);
+		if (bl->bl_dlo == bl->bl_dhi) {
+			bl->bl_dlo = boff;
+			bl->bl_dhi = boff + len;
+		} else {
+			bl->bl_dlo = MIN(bl->bl_dlo, boff);
+			bl->bl_dhi = MAX(bl->bl_dhi, boff + len);
+		}
+		bl->bl_len = MAX(bl->bl_len, boff + len);
+		bl->bl_ref = true;
+
+		data += len;
+		dlen -= len;
+		off += len;
+		*done += len;
+	}
+
+	if (sync) {
+		error = bc_flush(fd);
+		if (error != 0)
+			return error;
+		pthread_mutex_unlock(&bc_mtx);
+		error = fsync(fd) == -1 ? errno : 0;
+		pthread_mutex_lock(&bc_mtx);
+		return error;
+	}
+	return 0;
+}
+
+/*
+ * Writes back every dirty line of fd, or of all images if fd is -1.
+ */
+static int
+bc_flush(int fd)
+{
+	struct bc_line *bl;
+	int error, rv;
+
+	rv = 0;
+	for (bl = bc_lines; bl < bc_lines + bc_nlines; ++bl) {
+		/* a write back in progress must be done too */
+		while (bl->bl_busy)
+			pthread_cond_wait(&bc_cv, &bc_mtx);
+		if (bl->bl_blk == -1 || (fd != -1 && bl->bl_fd != fd))
+			continue;
+		error = bc_writeback(bl);
+		if (error != 0 && rv == 0)
+			rv = error;
+	}
+	return rv;
+}
+
+static void
+bc_exit(void)
+{
+	int error;
+
+	pthread_mutex_lock(&bc_mtx);
+	error = bc_flush(-1);
+	pthread_mutex_unlock(&bc_mtx);
+	if (error != 0) {
+		errno = error;
+		warn("block cache write back failed, image may be dirty!");
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hooks into the block I/O of the rump kernel.
+ *
+ * The image registered with etfs is read and written by librumpuser
+ * through the rumpuser_bio() hypercall.  libfsu is linked before
+ * librumpuser, so the definitions below take the place of the
+ * hypercalls and hand the requests to the layers of fsu_bio.h, or to
+ * librumpuser when none is enabled.  The overlay, the image formats,
+ * direct I/O and the block cache, in this order, complete the requests
+ * themselves and take precedence over the io_uring backend.  The size of
+ * an image in a format is the one of what it holds.  The reads of all
+ * of them go to the access profile when one is recorded.  With a statically
+ * linked rump kernel they cannot be interposed and the layers are not
+ * available.
+ */
+
+#define _GNU_SOURCE		/* RTLD_NEXT */
+
+#include "fs-utils.h"
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#ifndef NO_COMPONENT_DLOPEN
+
+static const struct rumpuser_hyperup *bio_hyp;
+static int (*bio_real_init)(int, const struct rumpuser_hyperup *);
+static int (*bio_real_open)(const char *, int, int *);
+static void (*bio_real_bio)(int, int, void *, size_t, int64_t,
+    rump_biodone_fn, void *);
+static int (*bio_real_close)(int);
+static int (*bio_real_getfileinfo)(const char *, uint64_t *, int *);
+static bool bio_cache, bio_uring;
+
+static void	*bio_sym(const char *);
+
+static void *
+bio_sym(const char *name)
+{
+	void *sym;
+
+	sym = dlsym(RTLD_NEXT, name);
+	if (sym == NULL)
+		errx(EXIT_FAILURE, "%s: %s", name, dlerror());
+	return sym;
+}
+
+int
+rumpuser_init(int version, const struct rumpuser_hyperup *hyp)
+{
+
+	bio_real_init = bio_sym("rumpuser_init");
+	bio_real_open = bio_sym("rumpuser_open");
+	bio_real_bio = bio_sym("rumpuser_bio");
+	bio_real_close = bio_sym("rumpuser_close");
+	bio_real_getfileinfo = bio_sym("rumpuser_getfileinfo");
+
+	/* the upcalls are only known for this version of the interface */
+	if (version == RUMPUSER_VERSION) {
+		bio_hyp = hyp;
+		bio_cache = fsu_bcache_init() == 0;
+		if (!bio_cache)
+			bio_uring = fsu_uring_init(hyp) == 0;
+	}
+
+	return bio_real_init(version, hyp);
+}
+
+int
+rumpuser_open(const char *path, int ruflags, int *fdp)
+{
+	int error;
+
+	/* with an overlay the image itself is never written */
+	if ((ruflags & RUMPUSER_OPEN_BIO) && fsu_overlay_wanted())
+		ruflags = (ruflags & ~RUMPUSER_OPEN_ACCMODE) |
+		    RUMPUSER_OPEN_RDONLY;
+
+	error = bio_real_open(path, ruflags, fdp);
+	if (error != 0 || !(ruflags & RUMPUSER_OPEN_BIO))
+		return error;
+
+	/* the overlay reads what the format holds */
+	error = fsu_image_open(*fdp);
+	if (error == 0)
+		error = fsu_overlay_open(*fdp);
+	if (error != 0) {
+		fsu_image_close(*fdp);
+		bio_real_close(*fdp);
+		return error;
+	}
+	if (!fsu_overlay_fd(*fdp) && !fsu_image_fd(*fdp))
+		fsu_direct_open(*fdp);
+
+	/* a profile is replayed into the caches the reads go through */
+	if (fsu_image_fd(*fdp))
+		fsu_prefetch_open(*fdp, fsu_image_io);
+	else if (bio_cache && !fsu_overlay_fd(*fdp) && !fsu_direct_fd(*fdp))
+		fsu_prefetch_open(*fdp, fsu_bcache_io);
+	else
+		fsu_prefetch_open(*fdp, NULL);
+	return 0;
+}
+
+int
+rumpuser_getfileinfo(const char *path, uint64_t *sizep, int *ftp)
+{
+	uint64_t size;
+	int error;
+
+	error = bio_real_getfileinfo(path, sizep, ftp);
+	if (error == 0 && *ftp == RUMPUSER_FT_REG &&
+	    fsu_image_format(path, &size, NULL) != NULL)
+		*sizep = size;
+	return error;
+}
+
+void
+rumpuser_bio(int fd, int op, void *data, size_t dlen, int64_t off,
+    rump_biodone_fn biodone, void *arg)
+{
+	int (*io)(int, int, void *, size_t, int64_t, size_t *);
+	size_t done;
+	int error, nlocks;
+
+	if (!(op & RUMPUSER_BIO_WRITE))
+		fsu_prefetch_record(fd, off, dlen);
+
+	if (fsu_overlay_fd(fd))
+		io = fsu_overlay_io;
+	else if (fsu_image_fd(fd))
+		io = fsu_image_io;
+	else if (fsu_direct_fd(fd))
+		io = fsu_direct_io;
+	else if (bio_cache)
+		io = fsu_bcache_io;
+	else {
+		if (bio_uring) {
+			/* waiting for a free slot must not hold the cpu */
+			bio_hyp->hyp_backend_unschedule(0, &nlocks, NULL);
+			error = fsu_uring_submit(fd, op, data, dlen, off,
+			    biodone, arg);
+			bio_hyp->hyp_backend_schedule(nlocks, NULL);
+			if (error == 0)
+				return;
+		}
+		bio_real_bio(fd, op, data, dlen, off, biodone, arg);
+		return;
+	}
+
+	/* like librumpuser, give up the virtual cpu while on the host */
+	bio_hyp->hyp_backend_unschedule(0, &nlocks, NULL);
+	error = io(fd, op, data, dlen, off, &done);
+	bio_hyp->hyp_backend_schedule(nlocks, NULL);
+
+	biodone(arg, done, error);
+}
+
+int
+rumpuser_close(int fd)
+{
+	int error;
+
+	fsu_prefetch_close(fd);
+	fsu_overlay_close(fd);
+	fsu_image_close(fd);
+	fsu_direct_close(fd);
+	/* dirty lines that failed to be written back keep fd open */
+	if (bio_cache && (error = fsu_bcache_close(fd)) != 0)
+		return error;
+	return bio_real_close(fd);
+}
+
+#endif /* !NO_COMPONENT_DLOPEN */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FSU_BIO_H_
+#define _FSU_BIO_H_
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Layers between the block I/O hypercall of the rump kernel and the
+ * image file, see fsu_bio.c.
+ */
+
+/* block cache, FSU_CACHE_MB */
+int	fsu_bcache_init(void);
+int	fsu_bcache_io(int, int, void *, size_t, int64_t, size_t *);
+int	fsu_bcache_close(int);
+
+/* io_uring backend, FSU_URING */
+struct rumpuser_hyperup;
+int	fsu_uring_init(const struct rumpuser_hyperup *);
+int	fsu_uring_submit(int, int, void *, size_t, int64_t,
+	    void (*)(void *, size_t, int), void *);
+
+/* direct I/O, -o direct or FSU_DIRECT */
+void	fsu_direct_enable(void);
+int	fsu_direct_open(int);
+bool	fsu_direct_fd(int);
+int	fsu_direct_io(int, int, void *, size_t, int64_t, size_t *);
+void	fsu_direct_close(int);
+
+/* qcow2 and seekable zstd images */
+const char *fsu_image_format(const char *, uint64_t *, const char **);
+int	fsu_image_open(int);
+bool	fsu_image_fd(int);
+int	fsu_image_size(int, uint64_t *);
+ssize_t	fsu_image_pread(int, void *, size_t, off_t);
+int	fsu_image_io(int, int, void *, size_t, int64_t, size_t *);
+void	fsu_image_close(int);
+
+/* access profile, -o profile=file */
+void	fsu_prefetch_enable(const char *);
+void	fsu_prefetch_open(int,
+	    int (*)(int, int, void *, size_t, int64_t, size_t *));
+void	fsu_prefetch_record(int, int64_t, size_t);
+void	fsu_prefetch_close(int);
+
+/* copy-on-write overlay, -o overlay=delta */
+void	fsu_overlay_enable(const char *);
+bool	fsu_overlay_wanted(void);
+int	fsu_overlay_open(int);
+bool	fsu_overlay_fd(int);
+int	fsu_overlay_io(int, int, void *, size_t, int64_t, size_t *);
+void	fsu_overlay_close(int);
+int	fsu_overlay_merge(const char *, const char *, const char *);
+
+#endif
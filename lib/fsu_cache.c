@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cache of the file system types detected for images.
+ *
+ * The cache is a text file under $XDG_CACHE_HOME (~/.cache by default)
+ * with one line per image, most recently used first:
+ *	st_dev st_ino st_size st_mtime offset fstype realpath
+ * Failing to read or write it only costs a new detection.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsu_cache.h"
+
+#define CACHE_DIR	"fs-utils"
+#define CACHE_FILE	"fstypes"
+#define CACHE_MAX	64		/* entries kept */
+
+#define CACHE_FMT	"%" PRIuMAX " %" PRIuMAX " %" PRIdMAX " %" PRIdMAX \
+			" %" PRIdMAX
+
+#define CACHE_LINE	(PATH_MAX + 128)
+
+struct cache_entry_s {
+	uintmax_t	ce_dev;
+	uintmax_t	ce_ino;
+	intmax_t	ce_size;
+	intmax_t	ce_mtime;
+	intmax_t	ce_off;
+	char		*ce_fstype;
+	char		*ce_path;
+};
+
+static int	cache_path(char *, size_t, bool);
+static int	cache_parse(char *, struct cache_entry_s *);
+
+static int
+cache_path(char *buf, size_t len, bool create)
+{
+	const char *xdg, *home;
+	int rv;
+
+	xdg = getenv("XDG_CACHE_HOME");
+	if (xdg != NULL && xdg[0] == '/')
+		rv = snprintf(buf, len, "%s/" CACHE_DIR, xdg);
+	else {
+		home = getenv("HOME");
+		if (home == NULL)
+			return -1;
+		rv = snprintf(buf, len, "%s/.cache", home);
+		if (rv < 0 || (size_t)rv >= len)
+			return -1;
+		if (create && mkdir(buf, 0700) == -1 && errno != EEXIST)
+			return -1;
+		rv = snprintf(buf, len, "%s/.cache/" CACHE_DIR, home);
+	}
+	if (rv < 0 || (size_t)rv >= len)
+		return -1;
+	if (create && mkdir(buf, 0700) == -1 && errno != EEXIST)
+		return -1;
+
+	if (strlcat(buf, "/" CACHE_FILE, len) >= len)
+		return -1;
+	return 0;
+}
+
+/*
+ * Splits a cache line, the strings are terminated in place.
+ */
+static int
+cache_parse(char *line, struct cache_entry_s *ce)
+{
+	char *p;
+	size_t len;
+	int n;
+
+	if (sscanf(line, CACHE_FMT " %n", &ce->ce_dev, &ce->ce_ino,
+	    &ce->ce_size, &ce->ce_mtime, &ce->ce_off, &n) != 5)
+		return -1;
+
+	ce->ce_fstype = line + n;
+	p = strchr(ce->ce_fstype, ' ');
+	if (p == NULL)
+		return -1;
+	*p++ = '\0';
+
+	len = strlen(p);
+	if (len > 0 && p[len - 1] == '\n')
+		p[len - 1] = '\0';
+	ce->ce_path = p;
+	return 0;
+}
+
+const char *
+fsu_cache_lookup(const char *path, off_t off)
+{
+	static char fstype[32];
+	struct cache_entry_s ce;
+	struct stat sb;
+	FILE *fp;
+	char file[PATH_MAX], line[CACHE_LINE];
+	const char *rv;
+
+	if (cache_path(file, sizeof(file), false) == -1)
+		return NULL;
+	if (stat(path, &sb) == -1)
+		return NULL;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return NULL;
+
+	rv = NULL;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (cache_parse(line, &ce) == -1 ||
+		    ce.ce_off != (intmax_t)off ||
+		    strcmp(ce.ce_path, path) != 0)
+			continue;
+
+		/* a changed image is detected again */
+		if (ce.ce_dev == (uintmax_t)sb.st_dev &&
+		    ce.ce_ino == (uintmax_t)sb.st_ino &&
+		    ce.ce_size == (intmax_t)sb.st_size &&
+		    ce.ce_mtime == (intmax_t)sb.st_mtime &&
+		    strlcpy(fstype, ce.ce_fstype, sizeof(fstype)) <
+		    sizeof(fstype))
+			rv = fstype;
+		break;
+	}
+	fclose(fp);
+	return rv;
+}
+
+/*
+ * Records fstype for the image at path and offset as it is now, in
+ * place of whatever was known about them before.
+ */
+void
+fsu_cache_store(const char *path, off_t off, const char *fstype)
+{
+	struct cache_entry_s ce;
+	struct stat sb;
+	FILE *fp, *tfp;
+	char file[PATH_MAX], tmp[PATH_MAX], entry[CACHE_LINE];
+	char line[CACHE_LINE];
+	int fd, n, rv;
+
+	if (cache_path(file, sizeof(file), true) == -1)
+		return;
+	if (stat(path, &sb) == -1)
+		return;
+
+	rv = snprintf(entry, sizeof(entry), CACHE_FMT " %s %s\n",
+	    (uintmax_t)sb.st_dev, (uintmax_t)sb.st_ino,
+	    (intmax_t)sb.st_size, (intmax_t)sb.st_mtime, (intmax_t)off,
+	    fstype, path);
+	if (rv < 0 || (size_t)rv >= sizeof(entry))
+		return;
+
+	fp = fopen(file, "r");
+	if (fp != NULL && fgets(line, sizeof(line), fp) != NULL &&
+	    strcmp(line, entry) == 0) {
+		/* nothing changed since the last run */
+		fclose(fp);
+		return;
+	}
+
+	rv = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file);
+	if (rv < 0 || (size_t)rv >= sizeof(tmp)) {
+		if (fp != NULL)
+			fclose(fp);
+		return;
+	}
+	if ((fd = mkstemp(tmp)) == -1 || (tfp = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			close(fd);
+			unlink(tmp);
+		}
+		if (fp != NULL)
+			fclose(fp);
+		return;
+	}
+
+	fputs(entry, tfp);
+	if (fp != NULL) {
+		rewind(fp);
+		n = 1;
+		while (n < CACHE_MAX &&
+		    fgets(line, sizeof(line), fp) != NULL) {
+			strlcpy(entry, line, sizeof(entry));
+			if (cache_parse(entry, &ce) == -1 ||
+			    (ce.ce_off == (intmax_t)off &&
+			    strcmp(ce.ce_path, path) == 0))
+				continue;
+			fputs(line, tfp);
+			++n;
+		}
+		fclose(fp);
+	}
+
+	/* replace the cache in one go, concurrent runs may race here */
+	if (fclose(tfp) != 0 || rename(tmp, file) == -1)
+		unlink(tmp);
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Direct I/O for the image, enabled with -o direct or FSU_DIRECT=1.
+ *
+ * The rump kernel keeps its own buffer cache, so the blocks of the
+ * image are best kept out of the page cache of the host.  The image is
+ * switched to O_DIRECT when it is opened and its reads and writes go
+ * through a bounce buffer aligned to DIO_ALIGN, with a read-modify-write
+ * of the partial blocks at either end of a write.  Requests that are
+ * aligned already skip the bounce buffer.
+ *
+ * When the host file system refuses O_DIRECT the image is accessed as
+ * usual and the range of every request is dropped from the page cache
+ * with posix_fadvise() afterwards.
+ */
+
+#define _GNU_SOURCE		/* O_DIRECT, sync_file_range() */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#define DIO_ALIGN	4096
+#define DIO_BOUNCE	(1024 * 1024)
+#define DIO_FDS		4		/* images opened for direct I/O */
+
+#define DIO_TRUNC(x)	((x) & ~(int64_t)(DIO_ALIGN - 1))
+#define DIO_ROUND(x)	DIO_TRUNC((x) + DIO_ALIGN - 1)
+
+struct dio_fd {
+	int		df_fd;		/* -1 when free */
+	bool		df_direct;	/* O_DIRECT accepted */
+};
+
+static pthread_mutex_t dio_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct dio_fd dio_fds[DIO_FDS] = {
+	{ -1, false }, { -1, false }, { -1, false }, { -1, false }
+};
+static uint8_t *dio_buf;
+static bool dio_enabled;
+
+static struct dio_fd	*dio_lookup(int);
+static int		dio_setdirect(struct dio_fd *, bool);
+static int		dio_buffered(struct dio_fd *, int, void *, size_t,
+			    int64_t, size_t *);
+static int		dio_read(struct dio_fd *, uint8_t *, size_t, int64_t,
+			    size_t *);
+static int		dio_write(struct dio_fd *, uint8_t *, size_t,
+			    int64_t, size_t *);
+
+void
+fsu_direct_enable(void)
+{
+
+#ifdef NO_COMPONENT_DLOPEN
+	warnx("direct I/O is not available with a static rump kernel");
+#else
+	dio_enabled = true;
+#endif
+}
+
+/*
+ * Takes over the image opened on fd.  Returns -1 when direct I/O is
+ * not enabled.
+ */
+int
+fsu_direct_open(int fd)
+{
+	struct dio_fd *df;
+	size_t i;
+
+	if (!dio_enabled)
+		return -1;
+
+	pthread_mutex_lock(&dio_mtx);
+	if (dio_buf == NULL &&
+	    posix_memalign((void **)&dio_buf, DIO_ALIGN, DIO_BOUNCE) != 0) {
+		dio_buf = NULL;
+		pthread_mutex_unlock(&dio_mtx);
+		warnx("direct I/O: cannot allocate the bounce buffer");
+		return -1;
+	}
+
+	df = NULL;
+	for (i = 0; i < DIO_FDS; ++i) {
+		if (dio_fds[i].df_fd == -1) {
+			df = &dio_fds[i];
+			break;
+		}
+	}
+	if (df == NULL) {
+		pthread_mutex_unlock(&dio_mtx);
+		return -1;
+	}
+
+	df->df_fd = fd;
+	df->df_direct = false;
+	if (dio_setdirect(df, true) == -1)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+	pthread_mutex_unlock(&dio_mtx);
+
+	return 0;
+}
+
+bool
+fsu_direct_fd(int fd)
+{
+	bool rv;
+
+	pthread_mutex_lock(&dio_mtx);
+	rv = dio_lookup(fd) != NULL;
+	pthread_mutex_unlock(&dio_mtx);
+
+	return rv;
+}
+
+int
+fsu_direct_io(int fd, int op, void *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	struct dio_fd *df;
+	int error;
+
+	*done = 0;
+	if (off < 0)
+		return EINVAL;
+
+	pthread_mutex_lock(&dio_mtx);
+	df = dio_lookup(fd);
+	if (df == NULL)
+		error = EBADF;
+	else if (!df->df_direct)
+		error = dio_buffered(df, op, data, dlen, off, done);
+	else if (op & RUMPUSER_BIO_WRITE)
+		error = dio_write(df, data, dlen, off, done);
+	else
+		error = dio_read(df, data, dlen, off, done);
+
+	/* the host file system may refuse O_DIRECT only when used */
+	if (error == EINVAL && df->df_direct && *done == 0) {
+		dio_setdirect(df, false);
+		error = dio_buffered(df, op, data, dlen, off, done);
+	}
+
+	if (error == 0 && (op & (RUMPUSER_BIO_WRITE | RUMPUSER_BIO_SYNC)) ==
+	    (RUMPUSER_BIO_WRITE | RUMPUSER_BIO_SYNC) && fdatasync(fd) == -1)
+		error = errno;
+	pthread_mutex_unlock(&dio_mtx);
+
+	return error;
+}
+
+void
+fsu_direct_close(int fd)
+{
+	struct dio_fd *df;
+
+	pthread_mutex_lock(&dio_mtx);
+	df = dio_lookup(fd);
+	if (df != NULL)
+		df->df_fd = -1;
+	pthread_mutex_unlock(&dio_mtx);
+}
+
+static struct dio_fd *
+dio_lookup(int fd)
+{
+	size_t i;
+
+	for (i = 0; i < DIO_FDS; ++i)
+		if (dio_fds[i].df_fd == fd)
+			return &dio_fds[i];
+	return NULL;
+}
+
+static int
+dio_setdirect(struct dio_fd *df, bool direct)
+{
+	int flags;
+
+	flags = fcntl(df->df_fd, F_GETFL);
+	if (flags == -1)
+		return -1;
+	if (direct)
+		flags |= O_DIRECT;
+	else
+		flags &= ~O_DIRECT;
+	if (fcntl(df->df_fd, F_SETFL, flags) == -1)
+		return -1;
+	df->df_direct = direct;
+	return 0;
+}
+
+/* through the page cache, dropping what was used */
+static int
+dio_buffered(struct dio_fd *df, int op, void *data, size_t dlen,
+    int64_t off, size_t *done)
+{
+	uint8_t *p;
+	ssize_t n;
+
+	p = data;
+	while (*done < dlen) {
+		if (op & RUMPUSER_BIO_WRITE)
+			n = pwrite(df->df_fd, p + *done, dlen - *done,
+			    off + *done);
+		else
+			n = pread(df->df_fd, p + *done, dlen - *done,
+			    off + *done);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			break;
+		*done += n;
+	}
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	/* dirty pages are not dropped, write them out first */
+	if (op & RUMPUSER_BIO_WRITE)
+		sync_file_range(df->df_fd, off, *done,
+		    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+		    SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+	posix_fadvise(df->df_fd, off, *done, POSIX_FADV_DONTNEED);
+
+	return 0;
+}
+
+static int
+dio_read(struct dio_fd *df, uint8_t *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	int64_t aoff;
+	size_t head, alen, chunk;
+	ssize_t n;
+	bool bounce;
+
+	while (*done < dlen) {
+		bounce = (((uintptr_t)data + *done) | (off + *done) |
+		    (dlen - *done)) & (DIO_ALIGN - 1);
+		if (bounce) {
+			aoff = DIO_TRUNC(off + *done);
+			head = off + *done - aoff;
+			chunk = MIN(dlen - *done, DIO_BOUNCE - head);
+			alen = DIO_ROUND(head + chunk);
+			n = pread(df->df_fd, dio_buf, alen, aoff);
+		} else {
+			head = 0;
+			chunk = dlen - *done;
+			n = pread(df->df_fd, data + *done, chunk, off + *done);
+		}
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		/* short at the end of the image */
+		chunk = MIN(chunk, (size_t)n > head ? n - head : 0);
+		if (chunk == 0)
+			break;
+		if (bounce)
+			memcpy(data + *done, dio_buf + head, chunk);
+		*done += chunk;
+	}
+
+	return 0;
+}
+
+static int
+dio_write(struct dio_fd *df, uint8_t *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	struct stat sb;
+	int64_t aoff;
+	size_t head, alen, chunk;
+	ssize_t n;
+	int error;
+
+	if (fstat(df->df_fd, &sb) == -1)
+		return errno;
+
+	while (*done < dlen) {
+		if (!((((uintptr_t)data + *done) | (off + *done) |
+		    (dlen - *done)) & (DIO_ALIGN - 1))) {
+			n = pwrite(df->df_fd, data + *done, dlen - *done,
+			    off + *done);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				return errno;
+			}
+			if (n == 0)
+				return EIO;
+			*done += n;
+			continue;
+		}
+
+		aoff = DIO_TRUNC(off + *done);
+		head = off + *done - aoff;
+		chunk = MIN(dlen - *done, DIO_BOUNCE - head);
+		alen = DIO_ROUND(head + chunk);
+
+		/*
+		 * A block past the end of the image would grow it, write
+		 * the tail through the page cache instead.
+		 */
+		if (aoff + (int64_t)alen > sb.st_size) {
+			dio_setdirect(df, false);
+			chunk = 0;
+			error = dio_buffered(df, RUMPUSER_BIO_WRITE,
+			    data + *done, dlen - *done, off + *done, &chunk);
+			dio_setdirect(df, true);
+			*done += chunk;
+			return error;
+		}
+
+		/* read back the partial blocks at either end */
+		if (head != 0 || head + chunk != alen) {
+			n = pread(df->df_fd, dio_buf, alen, aoff);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				return errno;
+			}
+			/* a short read would write stale bytes back */
+			if ((size_t)n != alen)
+				return EIO;
+		}
+		memcpy(dio_buf + head, data + *done, chunk);
+
+		n = pwrite(df->df_fd, dio_buf, alen, aoff);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if ((size_t)n < head + chunk)
+			return EIO;
+		*done += chunk;
+	}
+
+	return 0;
+}
@@ -27,11 +27,14 @@
 
 #include "fs-utils.h"
 
+#include <sys/param.h>
 #include <sys/stat.h>
 
 #include <assert.h>
+#include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +44,90 @@
 
 #include <fsu_utils.h>
 
+#include "fsu_mount.h"
+
+#define RA_MAXDEPTH	16
+#define RA_SEQUENTIAL	2	/* sequential refills to read ahead again */
+
+/* the open streams, for fsu_fcloseall() */
+static LIST_HEAD(, fsu_file) fsu_files = LIST_HEAD_INITIALIZER(fsu_files);
+static pthread_mutex_t fsu_files_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Buffers filled by a thread of their own, in order from ra_head,
+ * while the stream is read sequentially.  A refill at another offset
+ * stops it until the stream has been read sequentially again for a
+ * while, a write or a seek drops what was read.
+ */
+struct ra_slot {
+	uint8_t		*rs_buf;
+	off_t		rs_off;
+	ssize_t		rs_len;
+	int		rs_err;
+#define RS_EMPTY	0
+#define RS_BUSY		1
+#define RS_FULL		2
+	int		rs_state;
+};
+
+struct fsu_readahead {
+	pthread_t	ra_thread;
+	pthread_mutex_t	ra_mtx;
+	pthread_cond_t	ra_cv;
+	int		ra_fd;
+	size_t		ra_bufsize;
+	bool		ra_active;	/* reading ahead from ra_next */
+	bool		ra_stop;	/* the stream is being closed */
+	bool		ra_dead;	/* no context for the thread */
+	uint64_t	ra_gen;		/* bumped when reads are dropped */
+	off_t		ra_next;
+	off_t		ra_lastend;	/* where the last refill ended */
+	int		ra_seq;
+	int		ra_depth;
+	int		ra_head, ra_tail, ra_queued;
+	struct ra_slot	ra_slots[RA_MAXDEPTH];
+};
+
+/*
+ * Buffers handed by the stream to a thread of their own which writes
+ * them out in order, from wb_head, while the stream fills the next one.
+ * The first error is kept for fsu_fflush() and fsu_fclose(), which
+ * wait for all of them to be written.
+ */
+struct wb_slot {
+	uint8_t		*ws_buf;	/* kept when written, for reuse */
+	off_t		ws_off;
+	size_t		ws_len;
+};
+
+struct fsu_writebehind {
+	pthread_t	wb_thread;
+	pthread_mutex_t	wb_mtx;
+	pthread_cond_t	wb_cv;
+	int		wb_fd;
+	bool		wb_ready;	/* the thread has its context */
+	bool		wb_dead;	/* no context for the thread */
+	bool		wb_stop;	/* write out what is left and exit */
+	int		wb_err;
+	int		wb_nslots;
+	int		wb_head, wb_tail, wb_queued;
+	struct wb_slot	*wb_slots;
+};
+
 static void	fsu_fill_buffer(FSU_FILE *);
+static int	fsu_flush_buffer(FSU_FILE *);
+static int	fsu_fflush_mode(FSU_FILE *, bool);
+static void	ra_start(FSU_FILE *);
+static void	ra_stop(FSU_FILE *);
+static void	ra_drop(FSU_FILE *);
+static bool	ra_fill(FSU_FILE *);
+static void	ra_refilled(FSU_FILE *, ssize_t);
+static void	*ra_thread(void *);
+static void	wb_start(FSU_FILE *);
+static int	wb_stop(FSU_FILE *);
+static int	wb_queue(FSU_FILE *);
+static int	wb_drain(FSU_FILE *);
+static void	*wb_thread(void *);
 
 char
 fsu_fgetc(FSU_FILE *file)
@@ -59,6 +145,8 @@ fsu_fgetc(FSU_FILE *file)
 			return EOF;
 
 		fsu_fill_buffer(file);
+		if (file->fd_fpos == file->fd_last)
+			return EOF;
 	}
 	++file->fd_fpos;
 
@@ -76,16 +164,24 @@ fsu_fputc(int c, FSU_FILE *file)
 		return EOF;
 	}
 
-	if (file->fd_fpos == file->fd_last) {
-		if (file->fd_eof || file->fd_err != 0)
-			return EOF;
+	if (file->fd_err != 0)
+		return EOF;
 
-		fsu_fill_buffer(file);
+	/* a full buffer is written out and a new one started */
+	if (file->fd_bpos == file->fd_bufsize) {
+		if (fsu_flush_buffer(file) == EOF)
+			return EOF;
+		file->fd_bpos = 0;
+		file->fd_last = file->fd_fpos;
 	}
-	++file->fd_fpos;
+	file->fd_buf[file->fd_bpos++] = c;
+	if (++file->fd_fpos > file->fd_last)
+		file->fd_last = file->fd_fpos;
 	file->fd_dirty = true;
 
-	return (file->fd_buf[file->fd_bpos++] = c);
+	if (fsu_fflush_mode(file, c == '\n') == EOF)
+		return EOF;
+	return (unsigned char)c;
 }
 
 
@@ -93,65 +189,291 @@ FSU_FILE
 *fsu_fopen(const char *fname, const char *mode)
 {
 	FSU_FILE *file;
-	struct stat sb;
-	int rv, flags;
+	int rv, flags, serrno;
 	mode_t mask;
 
 	umask((mask = umask(0)));
 	mask = ~mask;
 	flags = 0;
 
+	switch(mode[0]) {
+		case 'r':
+			flags |= O_RDONLY;
+			break;
+		case 'w':
+			flags |= O_WRONLY | O_CREAT | O_TRUNC;
+			break;
+		case 'a':
+			flags |= O_WRONLY | O_CREAT | O_APPEND;
+			break;
+		default:
+			errno = EINVAL;
+			return NULL;
+	}
+
+	if (strchr(mode, '+') != NULL)
+		flags = (flags & ~O_ACCMODE) | O_RDWR;
+
+	rv = rump_sys_open(fname, flags, 0666 & mask);
+	if (rv == -1)
+		return NULL;
+
+	file = fsu_fdopen(rv, mode);
+	if (file == NULL) {
+		serrno = errno;
+		rump_sys_close(rv);
+		errno = serrno;
+	}
+	return file;
+}
+
+/*
+ * Associates a stream with the rump kernel descriptor fd, opened in a
+ * way compatible with mode.
+ */
+FSU_FILE *
+fsu_fdopen(int fd, const char *mode)
+{
+	FSU_FILE *file;
+	struct stat sb;
+	const char *env;
+	char *ep;
+
+	if (rump_sys_fstat(fd, &sb) == -1)
+		return NULL;
 #ifdef EFTYPE
 	if (strchr(mode, 'f') != NULL && !S_ISREG(sb.st_mode)) {
 		errno = EFTYPE;
 		return NULL;
 	}
 #endif
+
 	file = malloc(sizeof(FSU_FILE));
 	if (file == NULL)
 		return NULL;
 
+	file->fd_fd = fd;
 	file->fd_err = 0;
 	file->fd_fpos = file->fd_bpos = file->fd_last = 0;
-	file->fd_mode = 0;
 	file->fd_eof = file->fd_dirty = false;
-
-	switch(mode[0]) {
-		case 'r':
-			flags |= O_RDONLY;
-			break;
-		case 'w':
-			flags |= O_WRONLY | O_CREAT | O_TRUNC;
-			break;
-		case 'a':
-			flags |= O_WRONLY | O_CREAT | O_APPEND;
-			file->fd_fpos = file->fd_last = sb.st_size;
-			break;
-
+	file->fd_buf = NULL;
+	file->fd_bufsize = 0;
+	file->fd_bufown = false;
+	file->fd_bmode = _IOFBF;
+	file->fd_ra = NULL;
+	file->fd_radepth = 0;
+	file->fd_wb = NULL;
+	file->fd_wblimit = 0;
+	file->fd_wbflags = 0;
+
+	switch (mode[0]) {
+	case 'r':
+		file->fd_mode = FSU_FILE_READ;
+		break;
+	case 'w':
+		file->fd_mode = FSU_FILE_WRITE;
+		break;
+	case 'a':
+		file->fd_mode = FSU_FILE_WRITE;
+		file->fd_fpos = file->fd_last = sb.st_size;
+		break;
+	default:
+		free(file);
+		errno = EINVAL;
+		return NULL;
 	}
-
 	if (strchr(mode, '+') != NULL)
-		flags |= O_RDWR;
+		file->fd_mode = FSU_FILE_READWRITE;
+
+	/* read ahead with "ra" after the mode, as many as FSU_READAHEAD */
+	if ((file->fd_mode & FSU_FILE_READ) != 0) {
+		if (strstr(mode + 1, "ra") != NULL)
+			file->fd_radepth = FSU_FILE_RADEPTH;
+		env = getenv("FSU_READAHEAD");
+		if (env != NULL && env[0] != '\0')
+			file->fd_radepth = atoi(env);
+		file->fd_radepth = MIN(MAX(file->fd_radepth, 0), RA_MAXDEPTH);
+	}
 
-	rv = rump_sys_open(fname, flags, 0666 & mask);
-	if (rv == -1) {
+	/* write behind with up to FSU_WRITEBEHIND megabytes, fsync */
+	env = getenv("FSU_WRITEBEHIND");
+	if ((file->fd_mode & FSU_FILE_WRITE) != 0 && env != NULL) {
+		file->fd_wblimit = (size_t)strtoul(env, &ep, 10) << 20;
+		if (strcmp(ep, ",fsync") == 0)
+			file->fd_wbflags |= FSU_WB_FSYNC;
+	}
+
+	/* one block of the file system at a time, at least */
+	if (fsu_setvbuf(file, NULL, _IOFBF,
+	    MAX((size_t)sb.st_blksize, FSU_FILE_BUFSIZE)) != 0) {
 		free(file);
 		return NULL;
 	}
-	file->fd_fd = rv;
-	file->fd_mode = flags & O_WRONLY ? FSU_FILE_WRITE : FSU_FILE_READ;
+
+	pthread_mutex_lock(&fsu_files_mtx);
+	LIST_INSERT_HEAD(&fsu_files, file, fd_link);
+	pthread_mutex_unlock(&fsu_files_mtx);
 	return file;
 }
 
+/*
+ * Gives the stream a buffer of size bytes, buf or one allocated when
+ * buf is NULL, and a buffering mode.  Whatever was read ahead is
+ * dropped and read again through the new buffer.
+ */
+int
+fsu_setvbuf(FSU_FILE *file, char *buf, int mode, size_t size)
+{
+	uint8_t *nbuf;
+
+	assert(file != NULL);
+
+	switch (mode) {
+	case _IONBF:
+		nbuf = file->fd_nbuf;
+		size = sizeof(file->fd_nbuf);
+		break;
+	case _IOFBF:
+	case _IOLBF:
+		if (size == 0)
+			size = file->fd_bufsize != 0 ?
+			    file->fd_bufsize : FSU_FILE_BUFSIZE;
+		if (buf != NULL)
+			nbuf = (uint8_t *)buf;
+		else if ((nbuf = malloc(size)) == NULL)
+			return EOF;
+		break;
+	default:
+		errno = EINVAL;
+		return EOF;
+	}
+
+	if (file->fd_buf != NULL && (file->fd_mode & FSU_FILE_WRITE) != 0 &&
+	    fsu_fflush(file) == EOF) {
+		if (nbuf != file->fd_nbuf && nbuf != (uint8_t *)buf)
+			free(nbuf);
+		return EOF;
+	}
+	ra_stop(file);
+	if (wb_stop(file) != 0) {
+		if (nbuf != file->fd_nbuf && nbuf != (uint8_t *)buf)
+			free(nbuf);
+		return EOF;
+	}
+	if (file->fd_bufown)
+		free(file->fd_buf);
+
+	file->fd_buf = nbuf;
+	file->fd_bufsize = size;
+	file->fd_bufown = nbuf != file->fd_nbuf && nbuf != (uint8_t *)buf;
+	file->fd_bmode = mode;
+	file->fd_bpos = 0;
+	file->fd_last = file->fd_fpos;
+	file->fd_eof = false;
+
+	/* buffers read ahead or written behind are swapped with this one */
+	if (file->fd_radepth > 0 && file->fd_bufown)
+		ra_start(file);
+	if (file->fd_wblimit > 0 && file->fd_bufown)
+		wb_start(file);
+	return 0;
+}
+
+/*
+ * Has the buffers of the stream written out by another thread, up to
+ * limit bytes of them at once, or by the caller when limit is 0.
+ */
+int
+fsu_writebehind(FSU_FILE *file, size_t limit, int flags)
+{
+
+	assert(file != NULL);
+
+	if ((file->fd_mode & FSU_FILE_WRITE) == 0) {
+		errno = EBADF;
+		return EOF;
+	}
+	if (fsu_fflush(file) == EOF || wb_stop(file) != 0)
+		return EOF;
+
+	file->fd_wblimit = limit;
+	file->fd_wbflags = flags;
+	if (file->fd_wblimit > 0 && file->fd_bufown)
+		wb_start(file);
+	return 0;
+}
+
 void
+fsu_setbuffer(FSU_FILE *file, char *buf, int size)
+{
+
+	if (buf == NULL)
+		fsu_setvbuf(file, NULL, _IONBF, 0);
+	else
+		fsu_setvbuf(file, buf, _IOFBF, (size_t)size);
+}
+
+int
 fsu_fclose(FSU_FILE *file)
 {
+	int rv, serrno;
 
 	assert(file != NULL);
 
-	fsu_fflush(file);
-	rump_sys_close(file->fd_fd);
+	pthread_mutex_lock(&fsu_files_mtx);
+	LIST_REMOVE(file, fd_link);
+	pthread_mutex_unlock(&fsu_files_mtx);
+
+	rv = 0;
+	serrno = 0;
+	ra_stop(file);
+	if ((file->fd_mode & FSU_FILE_WRITE) != 0) {
+		if (fsu_fflush(file) == EOF) {
+			serrno = errno;
+			rv = EOF;
+		}
+		if (wb_stop(file) != 0 && rv == 0) {
+			serrno = errno;
+			rv = EOF;
+		}
+		/* one fsync for everything written behind */
+		if (file->fd_wblimit > 0 &&
+		    (file->fd_wbflags & FSU_WB_FSYNC) != 0 &&
+		    rump_sys_fsync(file->fd_fd) == -1 && rv == 0) {
+			serrno = errno;
+			rv = EOF;
+		}
+	}
+	if (rump_sys_close(file->fd_fd) == -1 && rv == 0) {
+		serrno = errno;
+		rv = EOF;
+	}
+	if (file->fd_bufown)
+		free(file->fd_buf);
 	free(file);
+	if (rv != 0)
+		errno = serrno;
+	return rv;
+}
+
+/*
+ * Closes the streams left open, by a command of a batch that exited
+ * without closing them.  What they still had to write is written.
+ */
+void
+fsu_fcloseall(void)
+{
+	FSU_FILE *file;
+
+	for (;;) {
+		pthread_mutex_lock(&fsu_files_mtx);
+		file = LIST_FIRST(&fsu_files);
+		pthread_mutex_unlock(&fsu_files_mtx);
+		if (file == NULL)
+			break;
+		if (fsu_fclose(file) != 0)
+			warn("fsu_fclose");
+	}
 }
 
 void
@@ -163,6 +485,8 @@ fsu_rewind(FSU_FILE *file)
 	fsu_fflush(file);
 
 	file->fd_fpos = file->fd_bpos = file->fd_last = 0;
+	file->fd_eof = false;
+	ra_drop(file);
 
 	fsu_fill_buffer(file);
 }
@@ -198,8 +522,7 @@ fsu_ferror(FSU_FILE *file)
 size_t
 fsu_fwrite(void *ptr, size_t size, size_t nmemb, FSU_FILE *file)
 {
-	int rv;
-	ssize_t rsize;
+	ssize_t rv, rsize;
 	unsigned char *p;
 
 	assert(file != NULL);
@@ -216,39 +539,55 @@ fsu_fwrite(void *ptr, size_t size, size_t nmemb, FSU_FILE *file)
 		return 0;
 
 	p = ptr;
-	if (rsize > (ssize_t)(sizeof(file->fd_buf) - file->fd_bpos)) {
-
-		fsu_fflush(file);
+	if (rsize > (ssize_t)(file->fd_bufsize - file->fd_bpos)) {
+		/* the buffer starts again where the stream is */
+		if (fsu_flush_buffer(file) == EOF)
+			return 0;
+		file->fd_bpos = 0;
+		file->fd_last = file->fd_fpos;
+		file->fd_eof = false;
+	}
 
-		while (rsize > (ssize_t)sizeof(file->fd_buf)) {
-			rv = rump_sys_pwrite(file->fd_fd, p, sizeof(file->fd_buf), file->fd_fpos);
+	if (rsize >= (ssize_t)file->fd_bufsize && file->fd_wb == NULL) {
+		/* as much as the buffer holds, written from the caller */
+		ra_drop(file);
+		while (rsize > 0) {
+			rv = rump_sys_pwrite(file->fd_fd, p, rsize,
+			    file->fd_fpos);
 			if (rv == -1) {
 				file->fd_err = errno;
-				return 0;
+				break;
 			}
 			p += rv;
 			rsize -= rv;
 			file->fd_fpos += rv;
 		}
-		rv = rump_sys_pwrite(file->fd_fd, p, rsize, file->fd_fpos);
-		if (rv == -1) {
-			file->fd_err = errno;
-			return 0;
-		}
+		file->fd_bpos = 0;
+		file->fd_last = file->fd_fpos;
+		return (size * nmemb - rsize) / size;
+	}
 
+	/* written behind, whatever the size, a buffer at a time */
+	while (rsize > 0) {
+		if (file->fd_bpos == file->fd_bufsize) {
+			if (fsu_flush_buffer(file) == EOF)
+				return (size * nmemb - rsize) / size;
+			file->fd_bpos = 0;
+			file->fd_last = file->fd_fpos;
+		}
+		rv = MIN(rsize, (ssize_t)(file->fd_bufsize - file->fd_bpos));
+		memcpy(file->fd_buf + file->fd_bpos, p, rv);
 		file->fd_fpos += rv;
-
-		if (rv == rsize) {
+		file->fd_bpos += rv;
+		if (file->fd_fpos > file->fd_last)
 			file->fd_last = file->fd_fpos;
-			fsu_fill_buffer(file);
-		} else
-			nmemb = (rsize - rv) / size;
-	} else {
-		memcpy(file->fd_buf + file->fd_bpos, ptr, rsize);
-		file->fd_fpos += rsize;
-		file->fd_bpos += rsize;
 		file->fd_dirty = true;
+		p += rv;
+		rsize -= rv;
 	}
+	if (fsu_fflush_mode(file, file->fd_bmode == _IOLBF &&
+	    memchr(ptr, '\n', size * nmemb) != NULL) == EOF)
+		return 0;
 
 	return nmemb;
 }
@@ -265,14 +604,54 @@ fsu_fflush(FSU_FILE *file)
 		return EOF;
 	}
 
-	if (file->fd_dirty) {
-		rv = rump_sys_pwrite(file->fd_fd, file->fd_buf,
-				file->fd_bpos,
-				file->fd_fpos - file->fd_bpos);
-		if (rv == -1 || rv != (int)file->fd_bpos)
-			file->fd_err = errno;
-		file->fd_dirty = false;
+	rv = fsu_flush_buffer(file);
+	if (file->fd_wb != NULL && wb_drain(file) != 0)
+		rv = EOF;
+	return rv;
+}
+
+/*
+ * Writes out the buffer if it was modified, or hands it to the thread
+ * writing behind, in which case the stream starts a new buffer.
+ */
+static int
+fsu_flush_buffer(FSU_FILE *file)
+{
+	int rv;
+
+	if (!file->fd_dirty)
+		return 0;
+
+	ra_drop(file);
+	if (file->fd_wb != NULL) {
+		if (wb_queue(file) == 0)
+			return 0;
+		/* no buffer in exchange, written after the others then */
+		if (wb_drain(file) != 0)
+			return EOF;
 	}
+
+	rv = rump_sys_pwrite(file->fd_fd, file->fd_buf,
+			file->fd_bpos,
+			file->fd_fpos - file->fd_bpos);
+	file->fd_dirty = false;
+	if (rv == -1 || rv != (int)file->fd_bpos) {
+		file->fd_err = rv == -1 ? errno : EIO;
+		return EOF;
+	}
+	return 0;
+}
+
+/*
+ * Writes out what line buffered and unbuffered streams are not to keep,
+ * nl tells whether a new line was just written.
+ */
+static int
+fsu_fflush_mode(FSU_FILE *file, bool nl)
+{
+
+	if (file->fd_bmode == _IONBF || (file->fd_bmode == _IOLBF && nl))
+		return fsu_flush_buffer(file);
 	return 0;
 }
 
@@ -307,6 +686,8 @@ fsu_fseeko(FSU_FILE *file, off_t off, int whence)
 		return -1;
 		/* NOTREACHED */
 	}
+	file->fd_eof = false;
+	ra_drop(file);
 	if (file->fd_fpos >= (size_t)sb.st_size) {
 		file->fd_last = file->fd_fpos;
 		file->fd_bpos = 0;
@@ -329,6 +710,79 @@ fsu_ftello(FSU_FILE *file)
 	return (off_t)file->fd_fpos;
 }
 
+/*
+ * The rump kernel descriptor of the stream, for I/O that goes around
+ * the stream altogether.
+ */
+int
+fsu_fileno(FSU_FILE *file)
+{
+
+	assert(file != NULL);
+
+	return file->fd_fd;
+}
+
+/*
+ * Positional I/O at off, past the buffer and without moving the
+ * stream.  Only the descriptor and the access mode, which do not change
+ * while the stream is open, are used so that several threads may do it
+ * on the same stream at once.  What is buffered for the stream is not
+ * seen or updated: flush it first, and seek to read through the buffer
+ * what was written this way.
+ */
+ssize_t
+fsu_pread(FSU_FILE *file, void *buf, size_t nbytes, off_t off)
+{
+
+	assert(file != NULL);
+
+	if ((file->fd_mode & FSU_FILE_READ) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return rump_sys_pread(file->fd_fd, buf, nbytes, off);
+}
+
+ssize_t
+fsu_pwrite(FSU_FILE *file, const void *buf, size_t nbytes, off_t off)
+{
+
+	assert(file != NULL);
+
+	if ((file->fd_mode & FSU_FILE_WRITE) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return rump_sys_pwrite(file->fd_fd, buf, nbytes, off);
+}
+
+ssize_t
+fsu_preadv(FSU_FILE *file, const struct iovec *iov, int iovcnt, off_t off)
+{
+
+	assert(file != NULL);
+
+	if ((file->fd_mode & FSU_FILE_READ) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return rump_sys_preadv(file->fd_fd, iov, iovcnt, off);
+}
+
+ssize_t
+fsu_pwritev(FSU_FILE *file, const struct iovec *iov, int iovcnt, off_t off)
+{
+
+	assert(file != NULL);
+
+	if ((file->fd_mode & FSU_FILE_WRITE) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return rump_sys_pwritev(file->fd_fd, iov, iovcnt, off);
+}
+
 static void
 fsu_fill_buffer(FSU_FILE *file)
 {
@@ -336,19 +790,446 @@ fsu_fill_buffer(FSU_FILE *file)
 
 	assert(file != NULL);
 
-	fsu_fflush(file);
+	if ((file->fd_mode & FSU_FILE_WRITE) != 0)
+		fsu_fflush(file);
 
-	rv = rump_sys_read(file->fd_fd, file->fd_buf, sizeof(file->fd_buf));
+	if (file->fd_ra != NULL && ra_fill(file))
+		return;
+
+	/* from where the stream is, the offset of the file may differ */
+	rv = rump_sys_pread(file->fd_fd, file->fd_buf, file->fd_bufsize,
+	    file->fd_fpos);
 
 	if (rv == -1) {
 		file->fd_err = errno;
   		file->fd_eof = true;
 		return;
-	} else if (rv < (int)sizeof(file->fd_buf))
+	} else if (rv < (int)file->fd_bufsize)
 		file->fd_eof = true;
 
 	file->fd_last = file->fd_fpos + rv;
 	file->fd_bpos = 0;
+
+	if (file->fd_ra != NULL)
+		ra_refilled(file, rv);
+}
+
+static void
+ra_start(FSU_FILE *file)
+{
+	struct fsu_readahead *ra;
+	int i, error;
+
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL)
+		return;
+	for (i = 0; i < file->fd_radepth; ++i) {
+		ra->ra_slots[i].rs_buf = malloc(file->fd_bufsize);
+		if (ra->ra_slots[i].rs_buf == NULL)
+			goto fail;
+	}
+	ra->ra_fd = file->fd_fd;
+	ra->ra_bufsize = file->fd_bufsize;
+	ra->ra_depth = file->fd_radepth;
+	ra->ra_active = true;
+	ra->ra_next = ra->ra_lastend = file->fd_fpos;
+	pthread_mutex_init(&ra->ra_mtx, NULL);
+	pthread_cond_init(&ra->ra_cv, NULL);
+
+	error = pthread_create(&ra->ra_thread, NULL, ra_thread, ra);
+	if (error != 0) {
+		pthread_cond_destroy(&ra->ra_cv);
+		pthread_mutex_destroy(&ra->ra_mtx);
+		goto fail;
+	}
+	file->fd_ra = ra;
+	return;
+
+fail:
+	for (i = 0; i < file->fd_radepth; ++i)
+		free(ra->ra_slots[i].rs_buf);
+	free(ra);
+}
+
+static void
+ra_stop(FSU_FILE *file)
+{
+	struct fsu_readahead *ra;
+	int i;
+
+	if ((ra = file->fd_ra) == NULL)
+		return;
+
+	pthread_mutex_lock(&ra->ra_mtx);
+	ra->ra_stop = true;
+	pthread_cond_broadcast(&ra->ra_cv);
+	pthread_mutex_unlock(&ra->ra_mtx);
+	pthread_join(ra->ra_thread, NULL);
+
+	pthread_cond_destroy(&ra->ra_cv);
+	pthread_mutex_destroy(&ra->ra_mtx);
+	for (i = 0; i < ra->ra_depth; ++i)
+		free(ra->ra_slots[i].rs_buf);
+	free(ra);
+	file->fd_ra = NULL;
+}
+
+/*
+ * Drops what was read ahead and stops reading ahead until the stream
+ * is read sequentially again.  The slot being read, if any, is left
+ * to the thread.
+ */
+static void
+ra_drop(FSU_FILE *file)
+{
+	struct fsu_readahead *ra;
+	int i;
+
+	if ((ra = file->fd_ra) == NULL)
+		return;
+
+	pthread_mutex_lock(&ra->ra_mtx);
+	for (i = 0; i < ra->ra_depth; ++i)
+		if (ra->ra_slots[i].rs_state == RS_FULL)
+			ra->ra_slots[i].rs_state = RS_EMPTY;
+	ra->ra_head = ra->ra_tail = ra->ra_queued = 0;
+	ra->ra_active = false;
+	ra->ra_seq = 0;
+	++ra->ra_gen;
+	pthread_mutex_unlock(&ra->ra_mtx);
+}
+
+/*
+ * Refills the buffer of the stream with the next buffer read ahead,
+ * false when the stream is to read it itself.
+ */
+static bool
+ra_fill(FSU_FILE *file)
+{
+	struct fsu_readahead *ra;
+	struct ra_slot *rs;
+	uint8_t *buf;
+	off_t off;
+
+	ra = file->fd_ra;
+	pthread_mutex_lock(&ra->ra_mtx);
+	if (!ra->ra_active && ra->ra_queued == 0) {
+		pthread_mutex_unlock(&ra->ra_mtx);
+		return false;
+	}
+
+	rs = &ra->ra_slots[ra->ra_head];
+	off = ra->ra_queued > 0 ? rs->rs_off : ra->ra_next;
+	if (off != (off_t)file->fd_fpos) {
+		/* not read sequentially, back off */
+		pthread_mutex_unlock(&ra->ra_mtx);
+		ra_drop(file);
+		return false;
+	}
+
+	while (ra->ra_queued == 0 || rs->rs_state != RS_FULL) {
+		if (!ra->ra_active && ra->ra_queued == 0) {
+			pthread_mutex_unlock(&ra->ra_mtx);
+			return false;
+		}
+		pthread_cond_wait(&ra->ra_cv, &ra->ra_mtx);
+	}
+
+	/* the slot takes the buffer of the stream in exchange */
+	buf = file->fd_buf;
+	file->fd_buf = rs->rs_buf;
+	rs->rs_buf = buf;
+	rs->rs_state = RS_EMPTY;
+	ra->ra_head = (ra->ra_head + 1) % ra->ra_depth;
+	--ra->ra_queued;
+
+	if (rs->rs_len == -1) {
+		file->fd_err = rs->rs_err;
+		file->fd_eof = true;
+		file->fd_last = file->fd_fpos;
+	} else {
+		if (rs->rs_len < (ssize_t)file->fd_bufsize)
+			file->fd_eof = true;
+		file->fd_last = file->fd_fpos + rs->rs_len;
+	}
+	file->fd_bpos = 0;
+	ra->ra_lastend = file->fd_last;
+	pthread_cond_broadcast(&ra->ra_cv);
+	pthread_mutex_unlock(&ra->ra_mtx);
+	return true;
+}
+
+/*
+ * Notes a refill of len bytes by the stream, reading ahead again after
+ * a few sequential ones.
+ */
+static void
+ra_refilled(FSU_FILE *file, ssize_t len)
+{
+	struct fsu_readahead *ra;
+
+	ra = file->fd_ra;
+	pthread_mutex_lock(&ra->ra_mtx);
+	if (ra->ra_lastend == (off_t)file->fd_fpos)
+		++ra->ra_seq;
+	else
+		ra->ra_seq = 0;
+	ra->ra_lastend = file->fd_fpos + len;
+
+	if (!ra->ra_dead && ra->ra_seq >= RA_SEQUENTIAL &&
+	    len == (ssize_t)ra->ra_bufsize) {
+		ra->ra_active = true;
+		ra->ra_next = ra->ra_lastend;
+		pthread_cond_broadcast(&ra->ra_cv);
+	}
+	pthread_mutex_unlock(&ra->ra_mtx);
+}
+
+static void *
+ra_thread(void *arg)
+{
+	struct fsu_readahead *ra = arg;
+	struct fsu_ctx *ctx;
+	struct ra_slot *rs;
+	uint64_t gen;
+	ssize_t rv;
+	off_t off;
+	int error;
+
+	/* an lwp of its own, the stream reads too */
+	ctx = fsu_ctx_open();
+
+	pthread_mutex_lock(&ra->ra_mtx);
+	if (ctx == NULL) {
+		ra->ra_dead = true;
+		ra->ra_active = false;
+		pthread_cond_broadcast(&ra->ra_cv);
+	}
+	while (!ra->ra_stop && !ra->ra_dead) {
+		rs = &ra->ra_slots[ra->ra_tail];
+		if (!ra->ra_active || ra->ra_queued == ra->ra_depth ||
+		    rs->rs_state != RS_EMPTY) {
+			pthread_cond_wait(&ra->ra_cv, &ra->ra_mtx);
+			continue;
+		}
+
+		rs->rs_state = RS_BUSY;
+		rs->rs_off = off = ra->ra_next;
+		ra->ra_next += ra->ra_bufsize;
+		ra->ra_tail = (ra->ra_tail + 1) % ra->ra_depth;
+		++ra->ra_queued;
+		gen = ra->ra_gen;
+		pthread_mutex_unlock(&ra->ra_mtx);
+
+		rv = rump_sys_pread(ra->ra_fd, rs->rs_buf, ra->ra_bufsize, off);
+		error = errno;
+
+		pthread_mutex_lock(&ra->ra_mtx);
+		if (gen != ra->ra_gen) {
+			rs->rs_state = RS_EMPTY;
+			continue;
+		}
+		rs->rs_len = rv;
+		rs->rs_err = rv == -1 ? error : 0;
+		rs->rs_state = RS_FULL;
+		/* nothing further to read */
+		if (rv < (ssize_t)ra->ra_bufsize)
+			ra->ra_active = false;
+		pthread_cond_broadcast(&ra->ra_cv);
+	}
+	pthread_mutex_unlock(&ra->ra_mtx);
+
+	fsu_ctx_close(ctx);
+	return NULL;
+}
+
+static void
+wb_start(FSU_FILE *file)
+{
+	struct fsu_writebehind *wb;
+	int error;
+
+	wb = calloc(1, sizeof(*wb));
+	if (wb == NULL)
+		return;
+	wb->wb_nslots = MAX(file->fd_wblimit / file->fd_bufsize, 1);
+	wb->wb_slots = calloc(wb->wb_nslots, sizeof(*wb->wb_slots));
+	if (wb->wb_slots == NULL) {
+		free(wb);
+		return;
+	}
+	wb->wb_fd = file->fd_fd;
+	pthread_mutex_init(&wb->wb_mtx, NULL);
+	pthread_cond_init(&wb->wb_cv, NULL);
+
+	error = pthread_create(&wb->wb_thread, NULL, wb_thread, wb);
+	if (error == 0) {
+		/* without a context of its own, the stream writes itself */
+		pthread_mutex_lock(&wb->wb_mtx);
+		while (!wb->wb_ready)
+			pthread_cond_wait(&wb->wb_cv, &wb->wb_mtx);
+		pthread_mutex_unlock(&wb->wb_mtx);
+		if (!wb->wb_dead) {
+			file->fd_wb = wb;
+			return;
+		}
+		pthread_join(wb->wb_thread, NULL);
+	}
+	pthread_cond_destroy(&wb->wb_cv);
+	pthread_mutex_destroy(&wb->wb_mtx);
+	free(wb->wb_slots);
+	free(wb);
+}
+
+/*
+ * Waits for what was handed over to be written and stops the thread,
+ * an error is returned as in wb_drain().
+ */
+static int
+wb_stop(FSU_FILE *file)
+{
+	struct fsu_writebehind *wb;
+	int i, rv;
+
+	if ((wb = file->fd_wb) == NULL)
+		return 0;
+
+	rv = wb_drain(file);
+	pthread_mutex_lock(&wb->wb_mtx);
+	wb->wb_stop = true;
+	pthread_cond_broadcast(&wb->wb_cv);
+	pthread_mutex_unlock(&wb->wb_mtx);
+	pthread_join(wb->wb_thread, NULL);
+
+	pthread_cond_destroy(&wb->wb_cv);
+	pthread_mutex_destroy(&wb->wb_mtx);
+	for (i = 0; i < wb->wb_nslots; ++i)
+		free(wb->wb_slots[i].ws_buf);
+	free(wb->wb_slots);
+	free(wb);
+	file->fd_wb = NULL;
+	return rv;
+}
+
+/*
+ * Hands the buffer of the stream over, once there is room for it, in
+ * exchange for one already written.
+ */
+static int
+wb_queue(FSU_FILE *file)
+{
+	struct fsu_writebehind *wb;
+	struct wb_slot *ws;
+	uint8_t *buf;
+
+	wb = file->fd_wb;
+	pthread_mutex_lock(&wb->wb_mtx);
+	while (wb->wb_queued == wb->wb_nslots)
+		pthread_cond_wait(&wb->wb_cv, &wb->wb_mtx);
+
+	ws = &wb->wb_slots[wb->wb_tail];
+	if (ws->ws_buf == NULL &&
+	    (ws->ws_buf = malloc(file->fd_bufsize)) == NULL) {
+		pthread_mutex_unlock(&wb->wb_mtx);
+		return -1;
+	}
+	buf = ws->ws_buf;
+	ws->ws_buf = file->fd_buf;
+	ws->ws_off = file->fd_fpos - file->fd_bpos;
+	ws->ws_len = file->fd_bpos;
+	wb->wb_tail = (wb->wb_tail + 1) % wb->wb_nslots;
+	++wb->wb_queued;
+	pthread_cond_broadcast(&wb->wb_cv);
+	pthread_mutex_unlock(&wb->wb_mtx);
+
+	file->fd_buf = buf;
+	file->fd_bpos = 0;
+	file->fd_last = file->fd_fpos;
+	file->fd_eof = false;
+	file->fd_dirty = false;
+	return 0;
+}
+
+/*
+ * Waits for everything handed over to be written, and returns the
+ * first error since the last call.
+ */
+static int
+wb_drain(FSU_FILE *file)
+{
+	struct fsu_writebehind *wb;
+	int error;
+
+	wb = file->fd_wb;
+	pthread_mutex_lock(&wb->wb_mtx);
+	while (wb->wb_queued > 0)
+		pthread_cond_wait(&wb->wb_cv, &wb->wb_mtx);
+	error = wb->wb_err;
+	wb->wb_err = 0;
+	pthread_mutex_unlock(&wb->wb_mtx);
+
+	if (error != 0) {
+		file->fd_err = errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+static void *
+wb_thread(void *arg)
+{
+	struct fsu_writebehind *wb = arg;
+	struct fsu_ctx *ctx;
+	struct wb_slot *ws;
+	uint8_t *p;
+	size_t len;
+	ssize_t rv;
+	off_t off;
+	int error;
+
+	/* an lwp of its own, the stream goes on meanwhile */
+	ctx = fsu_ctx_open();
+
+	pthread_mutex_lock(&wb->wb_mtx);
+	wb->wb_ready = true;
+	wb->wb_dead = ctx == NULL;
+	pthread_cond_broadcast(&wb->wb_cv);
+	while (!wb->wb_dead) {
+		if (wb->wb_queued == 0) {
+			if (wb->wb_stop)
+				break;
+			pthread_cond_wait(&wb->wb_cv, &wb->wb_mtx);
+			continue;
+		}
+		ws = &wb->wb_slots[wb->wb_head];
+		pthread_mutex_unlock(&wb->wb_mtx);
+
+		error = 0;
+		p = ws->ws_buf;
+		len = ws->ws_len;
+		off = ws->ws_off;
+		while (len > 0) {
+			rv = rump_sys_pwrite(wb->wb_fd, p, len, off);
+			if (rv <= 0) {
+				error = rv == -1 ? errno : EIO;
+				break;
+			}
+			p += rv;
+			len -= rv;
+			off += rv;
+		}
+
+		pthread_mutex_lock(&wb->wb_mtx);
+		if (error != 0 && wb->wb_err == 0)
+			wb->wb_err = error;
+		wb->wb_head = (wb->wb_head + 1) % wb->wb_nslots;
+		--wb->wb_queued;
+		pthread_cond_broadcast(&wb->wb_cv);
+	}
+	pthread_mutex_unlock(&wb->wb_mtx);
+
+	fsu_ctx_close(ctx);
+	return NULL;
 }
 
 /* from src/lib/libc/stdio/fread.c */
@@ -389,6 +1270,7 @@ fsu_fread(void *ptr, size_t size, size_t count, FSU_FILE *file)
 	size_t resid;
 	char *p;
 	int r;
+	ssize_t rv;
 	size_t total;
 
 	assert(file != NULL);
@@ -407,12 +1289,36 @@ fsu_fread(void *ptr, size_t size, size_t count, FSU_FILE *file)
 		memcpy(p, file->fd_buf + file->fd_bpos, r);
 
 		file->fd_fpos += r;
+		file->fd_bpos += r;
 		p += r;
 		resid -= r;
 
 		if (file->fd_eof)
 			return ((total - resid) / size);
 
+		/*
+		 * What is left fills the buffer at least, it is read into
+		 * the caller's memory instead of copied out of the buffer.
+		 */
+		if (resid >= file->fd_bufsize) {
+			while (resid > 0) {
+				rv = rump_sys_pread(file->fd_fd, p, resid,
+				    file->fd_fpos);
+				if (rv <= 0) {
+					if (rv == -1)
+						file->fd_err = errno;
+					file->fd_eof = true;
+					break;
+				}
+				file->fd_fpos += rv;
+				p += rv;
+				resid -= rv;
+			}
+			file->fd_bpos = 0;
+			file->fd_last = file->fd_fpos;
+			return ((total - resid) / size);
+		}
+
 		fsu_fill_buffer(file);
 	}
 	memcpy(p, file->fd_buf + file->fd_bpos, resid);
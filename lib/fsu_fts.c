@@ -91,6 +91,10 @@ static unsigned short fsu_fts_stat(FSU_FTS *, FSU_FTSENT *, int);
 #undef  FTS_ALLOC_ALIGNED
 #endif
 
+/* the open streams, for fsu_fts_closeall() */
+static LIST_HEAD(, _fsu_fts) fsu_fts_streams =
+    LIST_HEAD_INITIALIZER(fsu_fts_streams);
+
 #define	ISDOT(a)	(a[0] == '.' && (!a[1] || (a[1] == '.' && !a[2])))
 
 #define	CLR(opt)	(sp->fts_options &= ~(opt))
@@ -210,6 +214,7 @@ fsu_fts_open(char * const *argv, int options,
 	if (nitems == 0)
 		fsu_fts_free(parent);
 
+	LIST_INSERT_HEAD(&fsu_fts_streams, sp, fts_list);
 	return (sp);
 
 mem3:	fsu_fts_lfree(root);
@@ -254,6 +259,8 @@ fsu_fts_close(FSU_FTS *sp)
 
 	_DIAGASSERT(sp != NULL);
 
+	LIST_REMOVE(sp, fts_list);
+
 	/*
 	 * This still works if we haven't read anything -- the dummy structure
 	 * points to the root list, so we step through to the end of the root
@@ -284,6 +291,7 @@ fsu_fts_close(FSU_FTS *sp)
 	}
 
 	/* Free up the stream pointer. */
+	free(sp->fts_rpath);
 	free(sp);
 	if (saved_errno) {
 		errno = saved_errno;
@@ -293,6 +301,18 @@ fsu_fts_close(FSU_FTS *sp)
 	return 0;
 }
 
+/*
+ * Closes the streams left open, by a command of a batch that exited
+ * in the middle of a traversal.
+ */
+void
+fsu_fts_closeall(void)
+{
+
+	while (!LIST_EMPTY(&fsu_fts_streams))
+		fsu_fts_close(LIST_FIRST(&fsu_fts_streams));
+}
+
 #if !defined(__FSU_FTS_COMPAT_TAILINGSLASH)
 
 /*
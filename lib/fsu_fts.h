@@ -34,6 +34,8 @@
 #ifndef	_FSU_FTS_H_
 #define	_FSU_FTS_H_
 
+#include <sys/queue.h>
+
 #ifndef	__fsu_fts_stat_t
 #define	__fsu_fts_stat_t	struct stat
 #endif
@@ -98,7 +100,7 @@
 
 #endif /* !FTS_COMFOLLOW */
 
-typedef struct {
+typedef struct _fsu_fts {
 	struct _fsu_ftsent *fts_cur;	/* current node */
 	struct _fsu_ftsent *fts_child;	/* linked list of children */
 	struct _fsu_ftsent **fts_array;	/* sort array */
@@ -110,7 +112,7 @@ typedef struct {
 	int (*fts_compar)		/* compare function */
 		(const struct _fsu_ftsent **, const struct _fsu_ftsent **);
 	int fts_options;		/* fsu_fts_open options, global flags */
-
+	LIST_ENTRY(_fsu_fts) fts_list;	/* in the list of open streams */
 } FSU_FTS;
 
 typedef struct _fsu_ftsent {
@@ -145,6 +147,7 @@ typedef struct _fsu_ftsent {
 
 FSU_FTSENT	*fsu_fts_children(FSU_FTS *, int);
 int		fsu_fts_close(FSU_FTS *);
+void		fsu_fts_closeall(void);
 FSU_FTS		*fsu_fts_open(char * const *, int,
 			      int (*)(const FSU_FTSENT **,
 				      const FSU_FTSENT **));
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Huge pages for the memory of the rump kernel, enabled by
+ * FSU_HUGEPAGES, a comma separated list of:
+ *	1, thp		transparent huge pages
+ *	hugetlb		huge pages reserved on the host, transparent ones
+ *			when there are not enough of them
+ *	prefault	fault the memory in when it is set up
+ *
+ * The rump kernel gets its memory, the pages of its vnodes and of its
+ * buffer cache among others, from the rumpuser_malloc() hypercall.  Like
+ * the block I/O hooks of fsu_bio.c, the definition below takes its place
+ * and hands out blocks of an arena mapped at once, sized after the
+ * memory limit of the rump kernel, with huge pages.  Freed blocks are
+ * kept on a list per power of two size for the next allocation of that
+ * size.  Requests the arena cannot satisfy go to librumpuser.
+ */
+
+#define _GNU_SOURCE		/* RTLD_NEXT, MAP_HUGETLB */
+
+#include "fs-utils.h"
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_trace.h"
+
+#ifndef NO_COMPONENT_DLOPEN
+
+#define HP_SIZE		(2 * 1024 * 1024)
+#define HP_DEFAULT	(256ULL * 1024 * 1024)	/* without RUMP_MEMLIMIT */
+#define HP_MINSHIFT	6			/* 64 bytes */
+#define HP_MAXSHIFT	21			/* HP_SIZE */
+#define HP_NCLASS	(HP_MAXSHIFT - HP_MINSHIFT + 1)
+
+#define HP_ROUND(x, a)	(((x) + (a) - 1) & ~((uintptr_t)(a) - 1))
+
+struct hp_free {
+	struct hp_free	*hf_next;
+};
+
+static pthread_mutex_t hp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t hp_once = PTHREAD_ONCE_INIT;
+static uint8_t *hp_base, *hp_next, *hp_end;
+static struct hp_free *hp_freelist[HP_NCLASS];
+
+static int (*hp_real_malloc)(size_t, int, void **);
+static void (*hp_real_free)(void *, size_t);
+
+static void	hp_init(void);
+static uint64_t	hp_arenasize(void);
+static int	hp_class(size_t, int);
+
+/*
+ * The memory limit of the rump kernel and a quarter of it for what it
+ * allocates outside of the limit.
+ */
+static uint64_t
+hp_arenasize(void)
+{
+	const char *env;
+	char *ep;
+	unsigned long long limit;
+
+	env = getenv("RUMP_MEMLIMIT");
+	if (env == NULL || env[0] == '\0')
+		return HP_DEFAULT;
+	errno = 0;
+	limit = strtoull(env, &ep, 10);
+	if (errno != 0 || *ep != '\0' || limit == 0)
+		return HP_DEFAULT;
+	return HP_ROUND(limit + limit / 4, HP_SIZE);
+}
+
+static void
+hp_init(void)
+{
+	struct timespec ts;
+	const char *env, *kind;
+	char *opts, *p, *o;
+	uint8_t *base, *q;
+	uint64_t size;
+	bool thp, hugetlb, prefault;
+
+	hp_real_malloc = dlsym(RTLD_NEXT, "rumpuser_malloc");
+	hp_real_free = dlsym(RTLD_NEXT, "rumpuser_free");
+	if (hp_real_malloc == NULL || hp_real_free == NULL)
+		errx(EXIT_FAILURE, "rumpuser_malloc: %s", dlerror());
+
+	env = getenv("FSU_HUGEPAGES");
+	if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0)
+		return;
+	opts = strdup(env);
+	if (opts == NULL)
+		return;
+	thp = hugetlb = prefault = false;
+	for (p = opts; (o = strsep(&p, ",")) != NULL;) {
+		if (strcmp(o, "1") == 0 || strcmp(o, "thp") == 0)
+			thp = true;
+		else if (strcmp(o, "hugetlb") == 0)
+			hugetlb = true;
+		else if (strcmp(o, "prefault") == 0)
+			prefault = true;
+		else if (o[0] != '\0')
+			warnx("FSU_HUGEPAGES: %s: unknown", o);
+	}
+	free(opts);
+	if (!thp && !hugetlb)
+		thp = true;
+
+	fsu_trace_start(&ts);
+	size = hp_arenasize();
+	base = MAP_FAILED;
+	kind = "thp";
+#ifdef MAP_HUGETLB
+	if (hugetlb) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+		    (prefault ? MAP_POPULATE : 0), -1, 0);
+		if (base == MAP_FAILED)
+			warn("FSU_HUGEPAGES: hugetlb, using transparent ones");
+		else
+			kind = "hugetlb";
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	if (base == MAP_FAILED) {
+		/* aligned, so that the whole arena can be huge pages */
+		base = mmap(NULL, size + HP_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			warn("FSU_HUGEPAGES");
+			return;
+		}
+		q = (uint8_t *)HP_ROUND((uintptr_t)base, HP_SIZE);
+		if (q != base)
+			munmap(base, q - base);
+		munmap(q + size, HP_SIZE - (q - base));
+		base = q;
+		if (madvise(base, size, MADV_HUGEPAGE) == -1)
+			warn("FSU_HUGEPAGES: madvise");
+		if (prefault) {
+			/* one write per page brings a whole huge page in */
+			for (q = base; q < base + size; q += getpagesize())
+				*q = 0;
+		}
+	}
+#else
+	if (base == MAP_FAILED) {
+		warnx("FSU_HUGEPAGES: huge pages are not supported");
+		return;
+	}
+#endif
+	fsu_trace_end(&ts, "hugepages", kind, 0);
+
+	hp_base = hp_next = base;
+	hp_end = base + size;
+}
+
+/* the power of two size class of a request, -1 if too large */
+static int
+hp_class(size_t len, int alignment)
+{
+	size_t csize;
+	int shift;
+
+	csize = MAX(len, (size_t)MAX(alignment, 1));
+	for (shift = HP_MINSHIFT; shift <= HP_MAXSHIFT; ++shift)
+		if (((size_t)1 << shift) >= csize)
+			return shift - HP_MINSHIFT;
+	return -1;
+}
+
+int
+rumpuser_malloc(size_t len, int alignment, void **memp)
+{
+	struct hp_free *hf;
+	uint8_t *p;
+	size_t csize;
+	int c;
+
+	pthread_once(&hp_once, hp_init);
+	if (hp_base == NULL || (c = hp_class(len, alignment)) == -1)
+		return hp_real_malloc(len, alignment, memp);
+
+	csize = (size_t)1 << (c + HP_MINSHIFT);
+	pthread_mutex_lock(&hp_mtx);
+	hf = hp_freelist[c];
+	if (hf != NULL) {
+		hp_freelist[c] = hf->hf_next;
+		p = (uint8_t *)hf;
+	} else {
+		/* blocks are aligned on their size */
+		p = (uint8_t *)HP_ROUND((uintptr_t)hp_next, csize);
+		if (p + csize <= hp_end)
+			hp_next = p + csize;
+		else
+			p = NULL;
+	}
+	pthread_mutex_unlock(&hp_mtx);
+
+	if (p == NULL)
+		return hp_real_malloc(len, alignment, memp);
+	*memp = p;
+	return 0;
+}
+
+void
+rumpuser_free(void *mem, size_t len)
+{
+	struct hp_free *hf;
+	uint8_t *p;
+	int c;
+
+	p = mem;
+	if (p == NULL || p < hp_base || p >= hp_end) {
+		hp_real_free(mem, len);
+		return;
+	}
+
+	/*
+	 * Freed with the size it was allocated with but not the alignment,
+	 * a block rounded up for its alignment only returns its size.
+	 */
+	c = hp_class(len, 1);
+	hf = mem;
+	pthread_mutex_lock(&hp_mtx);
+	hf->hf_next = hp_freelist[c];
+	hp_freelist[c] = hf;
+	pthread_mutex_unlock(&hp_mtx);
+}
+
+#endif /* !NO_COMPONENT_DLOPEN */
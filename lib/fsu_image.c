@@ -0,0 +1,905 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compressed and sparse image formats, mounted without unpacking them.
+ *
+ * An image in one of the formats below is recognized when it is opened
+ * for block I/O and its blocks are looked up in the format instead of
+ * being read at the same offset of the file: the clusters of qcow2 and
+ * the frames of seekable zstd are read and inflated only when the rump
+ * kernel reads them.  Such images are read-only, -o overlay=delta takes
+ * the writes.
+ *
+ * The inflated units, and the L2 tables of qcow2, are kept in a cache of
+ * FSU_IMAGE_CACHE_MB megabytes shared by the images.  Clusters stored
+ * as they are in qcow2 are read from the image directly.
+ *
+ * qcow2 images with a backing file, encryption, an external data file
+ * or extended L2 entries are not supported.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#define IM_IMAGES	8		/* images opened at once */
+#define IM_LINES	4096
+#define IM_CACHE_MB	16
+#define IM_MAXUNIT	(16 * 1024 * 1024)	/* largest frame inflated */
+
+#define QC_MAGIC	0x514649fb	/* "QFI\xfb" */
+#define QC_HDRLEN2	72
+#define QC_OFFMASK	0x00fffffffffffe00ULL
+#define QC_COMPRESSED	(1ULL << 62)
+#define QC_ZERO		1ULL
+#define QC_INCOMPAT_CORRUPT	0x02
+#define QC_INCOMPAT_DATAFILE	0x04
+#define QC_INCOMPAT_CTYPE	0x08
+#define QC_INCOMPAT_EXTL2	0x10
+#define QC_INCOMPAT_KNOWN	0x1f
+#define QC_ZLIB		0
+#define QC_ZSTD		1
+#define QC_MAXL1	0x2000000	/* entries, as qemu */
+#define QC_L2KEY	(1ULL << 63)	/* cache key of an L2 table */
+
+#define ZS_MAGIC	0x8f92eab1	/* seek table footer */
+#define ZS_SKIPPABLE	0x184d2a5e
+#define ZS_FOOTER	9
+#define ZS_CHECKSUM	0x80
+#define ZS_RESERVED	0x7c
+#define ZS_MAXFRAMES	0x8000000
+
+struct im_image;
+
+/* what a guest offset maps to */
+struct im_extent {
+	enum { IE_ZERO, IE_HOST, IE_UNIT } ie_kind;
+	uint64_t	ie_off;		/* guest offset of the extent */
+	uint64_t	ie_len;
+	uint64_t	ie_key;		/* of the unit in the cache */
+	uint64_t	ie_host;	/* image offset of the data */
+	uint64_t	ie_hlen;	/* its length, when compressed */
+};
+
+typedef int (*im_fill_fn)(struct im_image *, const struct im_extent *,
+    uint8_t *);
+
+struct im_format {
+	const char	*if_name;
+	int		(*if_load)(struct im_image *, const uint8_t *, size_t,
+			    uint64_t);
+	int		(*if_map)(struct im_image *, uint64_t,
+			    struct im_extent *);
+	im_fill_fn	if_fill;
+};
+
+struct im_image {
+	int			im_fd;
+	const struct im_format	*im_fmt;	/* NULL when free */
+	uint64_t		im_size;	/* as seen by the rump kernel */
+	uint8_t			*im_scratch;	/* compressed unit */
+	size_t			im_scratchlen;
+	/* qcow2 */
+	unsigned		im_cbits;
+	int			im_ctype;
+	uint32_t		im_l1size;
+	uint64_t		*im_l1;
+	/* seekable zstd, where frame i starts in the image and the guest */
+	uint32_t		im_nframes;
+	uint64_t		*im_hoff;
+	uint64_t		*im_goff;
+#ifdef HAVE_LIBZSTD
+	ZSTD_DCtx		*im_dctx;
+#endif
+};
+
+struct im_line {
+	struct im_image	*il_im;		/* NULL when free */
+	uint64_t	il_key;
+	size_t		il_len;
+	uint64_t	il_used;	/* im_clock at the last use */
+	uint8_t		*il_data;
+};
+
+static pthread_mutex_t im_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct im_image im_images[IM_IMAGES];
+static struct im_line im_lines[IM_LINES];
+static size_t im_cached, im_budget;
+static uint64_t im_clock;
+static const char *im_why;		/* of the last load failure */
+
+static uint32_t	be32dec(const uint8_t *);
+static uint64_t	be64dec(const uint8_t *);
+static uint32_t	le32dec(const uint8_t *);
+static int	im_pread(int, void *, size_t, uint64_t);
+static int	im_load(struct im_image *, int);
+static void	im_unload(struct im_image *);
+static struct im_image *im_lookup(int);
+static uint8_t	*im_unit(struct im_image *, const struct im_extent *,
+		    im_fill_fn, int *);
+static int	im_read(struct im_image *, uint8_t *, size_t, uint64_t,
+		    size_t *);
+static int	qc_load(struct im_image *, const uint8_t *, size_t,
+		    uint64_t);
+static int	qc_map(struct im_image *, uint64_t, struct im_extent *);
+static int	qc_fill(struct im_image *, const struct im_extent *,
+		    uint8_t *);
+static int	qc_filll2(struct im_image *, const struct im_extent *,
+		    uint8_t *);
+static int	zs_load(struct im_image *, const uint8_t *, size_t,
+		    uint64_t);
+static int	zs_map(struct im_image *, uint64_t, struct im_extent *);
+static int	zs_fill(struct im_image *, const struct im_extent *,
+		    uint8_t *);
+
+static const struct im_format im_formats[] = {
+	{ "qcow2", qc_load, qc_map, qc_fill },
+	{ "seekable zstd", zs_load, zs_map, zs_fill },
+};
+
+static uint32_t
+be32dec(const uint8_t *p)
+{
+
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t
+be64dec(const uint8_t *p)
+{
+
+	return (uint64_t)be32dec(p) << 32 | be32dec(p + 4);
+}
+
+static uint32_t
+le32dec(const uint8_t *p)
+{
+
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* reads len bytes at off, short only at the end of the image */
+static int
+im_pread(int fd, void *buf, size_t len, uint64_t off)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < len; done += n) {
+		n = pread(fd, (uint8_t *)buf + done, len - done, off + done);
+		if (n == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0)
+			break;
+	}
+	return done;
+}
+
+/*
+ * Looks for the formats in the image on fd.  Returns 0 when one is
+ * found, -1 for a raw image or an errno, im_why telling why.
+ */
+static int
+im_load(struct im_image *im, int fd)
+{
+	uint8_t hdr[512];
+	struct stat sb;
+	size_t i;
+	int n, error;
+
+	if (fstat(fd, &sb) == -1)
+		return errno;
+	n = im_pread(fd, hdr, sizeof(hdr), 0);
+	if (n == -1)
+		return errno;
+
+	memset(im, 0, sizeof(*im));
+	im->im_fd = fd;
+	for (i = 0; i < sizeof(im_formats) / sizeof(im_formats[0]); ++i) {
+		im->im_fmt = &im_formats[i];
+		error = im->im_fmt->if_load(im, hdr, n,
+		    S_ISREG(sb.st_mode) ? (uint64_t)sb.st_size : 0);
+		if (error != -1) {
+			if (error != 0)
+				im_unload(im);
+			return error;
+		}
+	}
+	im->im_fmt = NULL;
+	return -1;
+}
+
+static void
+im_unload(struct im_image *im)
+{
+	size_t i;
+
+	for (i = 0; i < IM_LINES; ++i) {
+		if (im_lines[i].il_im == im) {
+			free(im_lines[i].il_data);
+			im_cached -= im_lines[i].il_len;
+			im_lines[i].il_im = NULL;
+		}
+	}
+	free(im->im_scratch);
+	free(im->im_l1);
+	free(im->im_hoff);
+	free(im->im_goff);
+#ifdef HAVE_LIBZSTD
+	if (im->im_dctx != NULL)
+		ZSTD_freeDCtx(im->im_dctx);
+#endif
+	memset(im, 0, sizeof(*im));
+}
+
+static struct im_image *
+im_lookup(int fd)
+{
+	size_t i;
+
+	for (i = 0; i < IM_IMAGES; ++i)
+		if (im_images[i].im_fmt != NULL && im_images[i].im_fd == fd)
+			return &im_images[i];
+	return NULL;
+}
+
+/*
+ * Returns the unit of the extent, from the cache or inflated by fill
+ * after making room for it, the least recently used units going first.
+ */
+static uint8_t *
+im_unit(struct im_image *im, const struct im_extent *ie, im_fill_fn fill,
+    int *errorp)
+{
+	struct im_line *il, *lru;
+	uint8_t *data;
+	size_t i;
+
+	il = NULL;
+	for (;;) {
+		lru = NULL;
+		for (i = 0; i < IM_LINES; ++i) {
+			if (im_lines[i].il_im == NULL) {
+				if (il == NULL)
+					il = &im_lines[i];
+				continue;
+			}
+			if (im_lines[i].il_im == im &&
+			    im_lines[i].il_key == ie->ie_key) {
+				im_lines[i].il_used = ++im_clock;
+				return im_lines[i].il_data;
+			}
+			if (lru == NULL || im_lines[i].il_used < lru->il_used)
+				lru = &im_lines[i];
+		}
+		if (lru == NULL ||
+		    (il != NULL && im_cached + ie->ie_len <= im_budget))
+			break;
+		free(lru->il_data);
+		im_cached -= lru->il_len;
+		lru->il_im = NULL;
+		il = NULL;
+	}
+
+	data = malloc(ie->ie_len);
+	if (data == NULL) {
+		*errorp = ENOMEM;
+		return NULL;
+	}
+	*errorp = fill(im, ie, data);
+	if (*errorp != 0) {
+		free(data);
+		return NULL;
+	}
+
+	il->il_im = im;
+	il->il_key = ie->ie_key;
+	il->il_len = ie->ie_len;
+	il->il_used = ++im_clock;
+	il->il_data = data;
+	im_cached += ie->ie_len;
+	return data;
+}
+
+static int
+im_read(struct im_image *im, uint8_t *data, size_t dlen, uint64_t off,
+    size_t *done)
+{
+	struct im_extent ie;
+	uint64_t pos;
+	uint8_t *unit;
+	size_t len;
+	int n, error;
+
+	if (off >= im->im_size)
+		return 0;
+	dlen = MIN(dlen, im->im_size - off);
+
+	while (*done < dlen) {
+		pos = off + *done;
+		error = im->im_fmt->if_map(im, pos, &ie);
+		if (error != 0)
+			return error;
+		len = MIN(dlen - *done, ie.ie_off + ie.ie_len - pos);
+
+		switch (ie.ie_kind) {
+		case IE_ZERO:
+			memset(data + *done, 0, len);
+			break;
+		case IE_HOST:
+			n = im_pread(im->im_fd, data + *done, len,
+			    ie.ie_host + (pos - ie.ie_off));
+			if (n == -1)
+				return errno;
+			if ((size_t)n != len)
+				return EIO;
+			break;
+		case IE_UNIT:
+			unit = im_unit(im, &ie, im->im_fmt->if_fill, &error);
+			if (unit == NULL)
+				return error;
+			memcpy(data + *done, unit + (pos - ie.ie_off), len);
+			break;
+		}
+		*done += len;
+	}
+	return 0;
+}
+
+/*
+ * qcow2: a two level table maps the clusters of the guest to those of
+ * the image, a cluster being stored as it is, deflated, or not at all
+ * when it reads as zeros.
+ */
+static int
+qc_load(struct im_image *im, const uint8_t *hdr, size_t len, uint64_t isize)
+{
+	uint64_t l1off, incompat, maxl1;
+	uint32_t version, hdrlen, i;
+	uint8_t *buf;
+	int n;
+
+	if (len < QC_HDRLEN2 || be32dec(hdr) != QC_MAGIC)
+		return -1;
+
+	version = be32dec(hdr + 4);
+	if (version != 2 && version != 3) {
+		im_why = "qcow2: unknown version";
+		return ENOTSUP;
+	}
+	if (be64dec(hdr + 8) != 0) {
+		im_why = "qcow2: backing files are not supported";
+		return ENOTSUP;
+	}
+	if (be32dec(hdr + 32) != 0) {
+		im_why = "qcow2: encrypted images are not supported";
+		return ENOTSUP;
+	}
+	im->im_cbits = be32dec(hdr + 20);
+	if (im->im_cbits < 9 || im->im_cbits > 21) {
+		im_why = "qcow2: invalid cluster size";
+		return EINVAL;
+	}
+
+	im->im_ctype = QC_ZLIB;
+	if (version == 3) {
+		if (len < 104) {
+			im_why = "qcow2: header too short";
+			return EINVAL;
+		}
+		incompat = be64dec(hdr + 72);
+		hdrlen = be32dec(hdr + 100);
+		if (incompat & QC_INCOMPAT_CORRUPT) {
+			im_why = "qcow2: image marked corrupt";
+			return EINVAL;
+		}
+		if (incompat & (QC_INCOMPAT_DATAFILE | QC_INCOMPAT_EXTL2 |
+		    ~(uint64_t)QC_INCOMPAT_KNOWN)) {
+			im_why = "qcow2: unsupported features";
+			return ENOTSUP;
+		}
+		if ((incompat & QC_INCOMPAT_CTYPE) && hdrlen > 104 &&
+		    len > 104)
+			im->im_ctype = hdr[104];
+		if (im->im_ctype != QC_ZLIB && im->im_ctype != QC_ZSTD) {
+			im_why = "qcow2: unknown compression type";
+			return ENOTSUP;
+		}
+	}
+
+	im->im_size = be64dec(hdr + 24);
+	im->im_l1size = be32dec(hdr + 36);
+	l1off = be64dec(hdr + 40);
+	maxl1 = howmany(im->im_size, (uint64_t)1 << (2 * im->im_cbits - 3));
+	if (im->im_l1size < maxl1 || im->im_l1size > QC_MAXL1 ||
+	    (isize != 0 && l1off + (uint64_t)im->im_l1size * 8 > isize)) {
+		im_why = "qcow2: invalid L1 table";
+		return EINVAL;
+	}
+
+	im->im_l1 = calloc(MAX(im->im_l1size, 1), sizeof(*im->im_l1));
+	buf = malloc(MAX(im->im_l1size, 1) * 8);
+	/* a compressed cluster spans at most 2^(cbits-8) sectors */
+	im->im_scratchlen = 2 << im->im_cbits;
+	im->im_scratch = malloc(im->im_scratchlen);
+	if (im->im_l1 == NULL || buf == NULL || im->im_scratch == NULL) {
+		free(buf);
+		return ENOMEM;
+	}
+	n = im_pread(im->im_fd, buf, (size_t)im->im_l1size * 8, l1off);
+	if (n == -1 || (size_t)n != (size_t)im->im_l1size * 8) {
+		free(buf);
+		im_why = "qcow2: cannot read the L1 table";
+		return EIO;
+	}
+	for (i = 0; i < im->im_l1size; ++i)
+		im->im_l1[i] = be64dec(buf + 8 * i);
+	free(buf);
+
+#ifdef HAVE_LIBZSTD
+	if (im->im_ctype == QC_ZSTD) {
+		im->im_dctx = ZSTD_createDCtx();
+		if (im->im_dctx == NULL)
+			return ENOMEM;
+	}
+#endif
+	return 0;
+}
+
+static int
+qc_map(struct im_image *im, uint64_t off, struct im_extent *ie)
+{
+	struct im_extent l2;
+	uint64_t cl, l2e;
+	uint32_t l1i, l2i;
+	uint8_t *tab;
+	unsigned x;
+	int error;
+
+	cl = off >> im->im_cbits;
+	l1i = cl >> (im->im_cbits - 3);
+	l2i = cl & (((uint64_t)1 << (im->im_cbits - 3)) - 1);
+
+	ie->ie_off = cl << im->im_cbits;
+	ie->ie_len = (uint64_t)1 << im->im_cbits;
+	ie->ie_kind = IE_ZERO;
+	if (l1i >= im->im_l1size || (im->im_l1[l1i] & QC_OFFMASK) == 0)
+		return 0;
+
+	memset(&l2, 0, sizeof(l2));
+	l2.ie_key = QC_L2KEY | (im->im_l1[l1i] & QC_OFFMASK);
+	l2.ie_len = ie->ie_len;
+	l2.ie_host = im->im_l1[l1i] & QC_OFFMASK;
+	tab = im_unit(im, &l2, qc_filll2, &error);
+	if (tab == NULL)
+		return error;
+	l2e = be64dec(tab + 8 * l2i);
+
+	if (l2e & QC_COMPRESSED) {
+		x = 62 - (im->im_cbits - 8);
+		ie->ie_kind = IE_UNIT;
+		ie->ie_key = cl;
+		ie->ie_host = l2e & (((uint64_t)1 << x) - 1);
+		ie->ie_hlen = (((l2e >> x) &
+		    (((uint64_t)1 << (im->im_cbits - 8)) - 1)) + 1) * 512 -
+		    (ie->ie_host & 511);
+	} else if (!(l2e & QC_ZERO) && (l2e & QC_OFFMASK) != 0) {
+		ie->ie_kind = IE_HOST;
+		ie->ie_host = l2e & QC_OFFMASK;
+	}
+	return 0;
+}
+
+static int
+qc_filll2(struct im_image *im, const struct im_extent *ie, uint8_t *data)
+{
+	int n;
+
+	n = im_pread(im->im_fd, data, ie->ie_len, ie->ie_host);
+	if (n == -1)
+		return errno;
+	return (size_t)n == ie->ie_len ? 0 : EIO;
+}
+
+/* the compressed data may run short of ie_hlen at the end of the image */
+static int
+qc_fill(struct im_image *im, const struct im_extent *ie, uint8_t *data)
+{
+	size_t clen;
+	int n;
+
+	clen = MIN(ie->ie_hlen, im->im_scratchlen);
+	n = im_pread(im->im_fd, im->im_scratch, clen, ie->ie_host);
+	if (n == -1)
+		return errno;
+
+	if (im->im_ctype == QC_ZSTD) {
+#ifdef HAVE_LIBZSTD
+		ZSTD_inBuffer in = { im->im_scratch, n, 0 };
+		ZSTD_outBuffer out = { data, ie->ie_len, 0 };
+		size_t rv;
+
+		ZSTD_DCtx_reset(im->im_dctx, ZSTD_reset_session_only);
+		do {
+			rv = ZSTD_decompressStream(im->im_dctx, &out, &in);
+			if (ZSTD_isError(rv))
+				return EIO;
+		} while (out.pos < out.size && in.pos < in.size);
+		return out.pos == out.size ? 0 : EIO;
+#else
+		return ENOTSUP;
+#endif
+	}
+
+#ifdef HAVE_LIBZ
+	{
+		z_stream zs;
+		int rv;
+
+		memset(&zs, 0, sizeof(zs));
+		if (inflateInit2(&zs, -12) != Z_OK)
+			return ENOMEM;
+		zs.next_in = im->im_scratch;
+		zs.avail_in = n;
+		zs.next_out = data;
+		zs.avail_out = ie->ie_len;
+		rv = inflate(&zs, Z_FINISH);
+		inflateEnd(&zs);
+		if ((rv != Z_STREAM_END && rv != Z_BUF_ERROR) ||
+		    zs.avail_out != 0)
+			return EIO;
+		return 0;
+	}
+#else
+	return ENOTSUP;
+#endif
+}
+
+/*
+ * Seekable zstd: independent frames followed by a seek table, in a
+ * skippable frame, giving the compressed and inflated size of each.
+ */
+static int
+zs_load(struct im_image *im, const uint8_t *hdr, size_t len, uint64_t isize)
+{
+	uint8_t foot[ZS_FOOTER];
+	uint64_t tablen;
+	uint32_t esize;
+#ifdef HAVE_LIBZSTD
+	uint8_t *tab;
+	uint64_t hmax;
+	uint32_t i;
+	int n;
+#endif
+
+	if (isize < ZS_FOOTER + 8 ||
+	    im_pread(im->im_fd, foot, ZS_FOOTER, isize - ZS_FOOTER) !=
+	    ZS_FOOTER || le32dec(foot + 5) != ZS_MAGIC)
+		return -1;
+
+	im->im_nframes = le32dec(foot);
+	esize = (foot[4] & ZS_CHECKSUM) ? 12 : 8;
+	tablen = (uint64_t)im->im_nframes * esize + ZS_FOOTER;
+	if ((foot[4] & ZS_RESERVED) || im->im_nframes > ZS_MAXFRAMES ||
+	    tablen + 8 > isize) {
+		im_why = "seekable zstd: invalid seek table";
+		return EINVAL;
+	}
+#ifndef HAVE_LIBZSTD
+	im_why = "seekable zstd: fs-utils was built without libzstd";
+	return ENOTSUP;
+#else
+	tab = malloc(tablen + 8);
+	im->im_hoff = calloc(im->im_nframes + 1, sizeof(*im->im_hoff));
+	im->im_goff = calloc(im->im_nframes + 1, sizeof(*im->im_goff));
+	im->im_dctx = ZSTD_createDCtx();
+	if (tab == NULL || im->im_hoff == NULL || im->im_goff == NULL ||
+	    im->im_dctx == NULL) {
+		free(tab);
+		return ENOMEM;
+	}
+	n = im_pread(im->im_fd, tab, tablen + 8, isize - tablen - 8);
+	if (n == -1 || (uint64_t)n != tablen + 8 ||
+	    le32dec(tab) != ZS_SKIPPABLE || le32dec(tab + 4) != tablen) {
+		free(tab);
+		im_why = "seekable zstd: invalid seek table";
+		return EINVAL;
+	}
+
+	hmax = 0;
+	for (i = 0; i < im->im_nframes; ++i) {
+		im->im_hoff[i + 1] = im->im_hoff[i] +
+		    le32dec(tab + 8 + i * esize);
+		im->im_goff[i + 1] = im->im_goff[i] +
+		    le32dec(tab + 8 + i * esize + 4);
+		hmax = MAX(hmax, im->im_hoff[i + 1] - im->im_hoff[i]);
+		if (im->im_goff[i + 1] - im->im_goff[i] > IM_MAXUNIT)
+			break;
+	}
+	free(tab);
+	if (i < im->im_nframes) {
+		im_why = "seekable zstd: frames too large";
+		return ENOTSUP;
+	}
+	if (im->im_hoff[im->im_nframes] != isize - tablen - 8) {
+		im_why = "seekable zstd: invalid seek table";
+		return EINVAL;
+	}
+	im->im_size = im->im_goff[im->im_nframes];
+	im->im_scratchlen = hmax;
+	im->im_scratch = malloc(MAX(hmax, 1));
+	if (im->im_scratch == NULL)
+		return ENOMEM;
+	return 0;
+#endif
+}
+
+static int
+zs_map(struct im_image *im, uint64_t off, struct im_extent *ie)
+{
+	uint32_t lo, hi, mid;
+
+	/* the last frame starting at or before off */
+	lo = 0;
+	hi = im->im_nframes;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (im->im_goff[mid] <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	ie->ie_kind = IE_UNIT;
+	ie->ie_key = lo;
+	ie->ie_off = im->im_goff[lo];
+	ie->ie_len = im->im_goff[lo + 1] - im->im_goff[lo];
+	ie->ie_host = im->im_hoff[lo];
+	ie->ie_hlen = im->im_hoff[lo + 1] - im->im_hoff[lo];
+	return 0;
+}
+
+static int
+zs_fill(struct im_image *im, const struct im_extent *ie, uint8_t *data)
+{
+#ifdef HAVE_LIBZSTD
+	size_t rv;
+	int n;
+
+	n = im_pread(im->im_fd, im->im_scratch, ie->ie_hlen, ie->ie_host);
+	if (n == -1)
+		return errno;
+	if ((uint64_t)n != ie->ie_hlen)
+		return EIO;
+	rv = ZSTD_decompressDCtx(im->im_dctx, data, ie->ie_len,
+	    im->im_scratch, n);
+	if (ZSTD_isError(rv) || rv != ie->ie_len)
+		return EIO;
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+/*
+ * Returns the name of the format of the image at path and its size as
+ * seen by the rump kernel, or NULL for a raw image or, with errno set
+ * and the reason in *whyp if whyp is not NULL, one that cannot be read.
+ */
+const char *
+fsu_image_format(const char *path, uint64_t *sizep, const char **whyp)
+{
+	struct im_image im;
+	const char *name;
+	int fd, error;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		error = errno;
+		if (whyp != NULL)
+			*whyp = strerror(error);
+		errno = error;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&im_mtx);
+	im_why = NULL;
+	error = im_load(&im, fd);
+	name = NULL;
+	if (error == 0) {
+		name = im.im_fmt->if_name;
+		*sizep = im.im_size;
+		im_unload(&im);
+	} else if (error != -1 && whyp != NULL)
+		*whyp = im_why != NULL ? im_why : strerror(error);
+	pthread_mutex_unlock(&im_mtx);
+	close(fd);
+
+	errno = error == -1 ? 0 : error;
+	return name;
+}
+
+/*
+ * Looks at the image just opened on fd.  Returns 0, also for a raw
+ * image, or an errno.
+ */
+int
+fsu_image_open(int fd)
+{
+	const char *env;
+	char *ep;
+	unsigned long mb;
+	struct im_image *im;
+	size_t i;
+	int error;
+
+	pthread_mutex_lock(&im_mtx);
+	if (im_budget == 0) {
+		mb = IM_CACHE_MB;
+		env = getenv("FSU_IMAGE_CACHE_MB");
+		if (env != NULL && env[0] != '\0') {
+			errno = 0;
+			mb = strtoul(env, &ep, 10);
+			if (errno != 0 || *ep != '\0' || mb == 0) {
+				warnx("FSU_IMAGE_CACHE_MB: %s: invalid size",
+				    env);
+				mb = IM_CACHE_MB;
+			}
+		}
+		im_budget = mb * 1024 * 1024;
+	}
+
+	for (i = 0, im = NULL; i < IM_IMAGES; ++i) {
+		if (im_images[i].im_fmt == NULL) {
+			im = &im_images[i];
+			break;
+		}
+	}
+	if (im == NULL) {
+		pthread_mutex_unlock(&im_mtx);
+		return EBUSY;
+	}
+
+	error = im_load(im, fd);
+	pthread_mutex_unlock(&im_mtx);
+	return error == -1 ? 0 : error;
+}
+
+bool
+fsu_image_fd(int fd)
+{
+
+	return im_lookup(fd) != NULL;
+}
+
+/*
+ * Size of the image on fd as seen by the rump kernel.
+ */
+int
+fsu_image_size(int fd, uint64_t *sizep)
+{
+	struct im_image *im;
+	struct stat sb;
+
+	im = im_lookup(fd);
+	if (im != NULL) {
+		*sizep = im->im_size;
+		return 0;
+	}
+	if (fstat(fd, &sb) == -1)
+		return -1;
+	*sizep = sb.st_size;
+	return 0;
+}
+
+/*
+ * pread(2) of what the rump kernel sees at off in the image on fd.
+ */
+ssize_t
+fsu_image_pread(int fd, void *buf, size_t len, off_t off)
+{
+	struct im_image *im;
+	size_t done;
+	int error;
+
+	im = im_lookup(fd);
+	if (im == NULL)
+		return pread(fd, buf, len, off);
+	if (off < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	done = 0;
+	pthread_mutex_lock(&im_mtx);
+	error = im_read(im, buf, len, off, &done);
+	pthread_mutex_unlock(&im_mtx);
+	if (error != 0 && done == 0) {
+		errno = error;
+		return -1;
+	}
+	return done;
+}
+
+int
+fsu_image_io(int fd, int op, void *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	struct im_image *im;
+	int error;
+
+	*done = 0;
+	if (op & RUMPUSER_BIO_WRITE)
+		return EROFS;
+	if (off < 0)
+		return EINVAL;
+
+	im = im_lookup(fd);
+	if (im == NULL)
+		return EBADF;
+	pthread_mutex_lock(&im_mtx);
+	error = im_read(im, data, dlen, off, done);
+	pthread_mutex_unlock(&im_mtx);
+	return error;
+}
+
+void
+fsu_image_close(int fd)
+{
+	struct im_image *im;
+
+	pthread_mutex_lock(&im_mtx);
+	im = im_lookup(fd);
+	if (im != NULL)
+		im_unload(im);
+	pthread_mutex_unlock(&im_mtx);
+}
@@ -36,6 +36,8 @@
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -48,14 +50,23 @@
 #include <rump/rump_syscalls.h>
 
 #include <fsu_utils.h>
+#include <mntopts.h>
 
 #include "fsu_mount.h"
 
 #include "filesystems.h"
 #include "fsu_alias.h"
+#include "fsu_bio.h"
+#include "fsu_cache.h"
+#include "fsu_part.h"
+#include "fsu_probe.h"
+#include "fsu_trace.h"
+#include "fsu_tune.h"
 
 #define MOUNT_DIRECTORY "/mnt"
 
+#define FSU_MAXIMAGES 8
+
 #define RUMPFSDEV "/dev/rumpfs"
 
 #ifndef __UNCONST
@@ -82,52 +93,139 @@ struct mount_data_s {
 	char mntd_canon_dev[PATH_MAX];
 	char mntd_canon_dir[PATH_MAX];
 	char *mntd_fsdevice;
+	char mntd_dir[16];		/* mount point */
+	const char *mntd_key;		/* etfs key of the image */
+	int mntd_partition;
+	char *mntd_overlay;
+	char *mntd_profile;		/* -o profile= */
+	off_t mntd_offset;		/* partition window on the image */
+	off_t mntd_size;
+	const char *mntd_detected;	/* autodetected type */
+	bool mntd_batch;		/* -o batch */
 	int mntd_flags;
 	int mntd_argc;
 	char **mntd_argv;
 	int mntd_argv_size;
 };
 
+struct mount_image_s;
+
 static int mount_alias(struct fsu_fsalias_s *, char *, char *,
     struct mount_data_s *, int);
 static int mount_fstype(fsu_fs_t *, const char *, char *, char *,
     char *, struct mount_data_s *, int);
+#ifndef NO_COMPONENT_DLOPEN
+static bool fsu_linked_fs(const char *);
+#endif
 static int fsu_load_fs(const char *);
+static int mount_image(char *, fsu_fs_t *, char *, char *, char *,
+    struct mount_data_s *, int);
+static char *mount_spec(char *, fsu_fs_t **);
+static int mount_chroot(void);
 
 static int mount_struct(_Bool, struct mount_data_s *);
+static char *mount_imgopts(char *, bool *, bool *, int *, char **,
+    char **, struct fsu_tune_s *);
+static void mount_sidecar(struct mount_image_s *, char *, size_t);
+static void mount_batch(struct mount_image_s *);
+static uint64_t mount_imgsize(const char *);
+static const char *mount_imgtype(const char *, int);
 extern int rump_i_know_what_i_am_doing_with_sysents;
 
+static bool mounted;
+static pid_t mount_pid;		/* rump process the utility runs in */
+
+/*
+ * A thread of the rump process the images are mounted in, bound to the
+ * host thread that opened it.
+ */
+struct fsu_ctx {
+	struct lwp	*fc_lwp;
+	struct lwp	*fc_prev;	/* lwp of the thread before */
+	pid_t		fc_pid;		/* process before fsu_proc_open() */
+};
+
 /*
- * Tries to mount an image.
+ * The mounted images, at MOUNT_DIRECTORY or, when there are several,
+ * at MOUNT_DIRECTORY/0, /1, ...  The autodetected types are recorded
+ * in the type cache when unmounting.
+ */
+static struct mount_image_s {
+	char		mi_dir[16];
+	char		mi_dev[PATH_MAX];
+	off_t		mi_off;
+	int		mi_part;
+	bool		mi_batch;	/* sidecar to remove when unmounted */
+	const char	*mi_fstype;
+} images[FSU_MAXIMAGES];
+static int nimages;
+
+/*
+ * What fsu_mount() parsed, kept until fsu_mount_now() boots the rump
+ * kernel and mounts the images.
+ */
+static struct mount_args_s {
+	fsu_fs_t		*ma_fst;
+	fsu_fs_t		*ma_devfst[FSU_MAXIMAGES];
+	char			*ma_devs[FSU_MAXIMAGES];
+	struct fsu_fsalias_s	*ma_alias;
+	struct fsu_tune_s	ma_tune;
+	char			*ma_mntopts;
+	char			*ma_puffsexec;
+	char			*ma_specopts;
+	char			*ma_overlay;
+	char			*ma_profile;
+	int			ma_ndev;
+	int			ma_partition;
+	int			ma_verbose;
+	bool			ma_fflag;
+	bool			ma_batch;
+} margs;
+static bool pending;		/* parsed, not mounted yet */
+
+/*
+ * Parses the mount arguments and checks the images on the host, then
+ * mounts them unless mode has MOUNT_DEFER, in which case fsu_mount_now()
+ * must be called before the first access to the image: usage errors and
+ * failures on host paths then never boot the rump kernel.
  * if the fstype is not given try every supported types.
+ * With several -f, each image is mounted on a directory of its own
+ * named after its position and the process is chrooted above them.
+ * Once an image is mounted (fsu -b) further calls leave argv alone.
  */
 int
 fsu_mount(int *argc, char **argv[], int mode)
 {
 	fsu_fs_t *fst;
 	struct fsu_fsalias_s *alias;
-	struct mount_data_s mntd;
+	struct mount_args_s *ma;
 	int idx, fflag, rv, verbose;
-	int ch, stopopts;
-	char *mntopts, afsdev[PATH_MAX], *puffsexec, *specopts;
+	int ch, stopopts, partition, ndev, i;
+	bool batch, direct;
+	char *mntopts, *puffsexec, *specopts, *overlay, *profile;
 	char *tmp;
-	char *fsdevice, *fstype;
-	struct stat sb;
+	char *fsdevice, *fstype, **devs;
+	const char *tunetype;
+	fsu_fs_t **devfst;
+	uint64_t imgsize;
 #ifdef WITH_SYSPUFFS
 	const char options[] = GETOPT_PREFIX"f:o:p:s:t:v";
 #else
 	const char options[] = GETOPT_PREFIX"f:o:s:t:v";
 #endif
 
+	if (mounted || pending)
+		return 0;
+
+	ma = &margs;
+	devs = ma->ma_devs;
+	devfst = ma->ma_devfst;
 	alias = NULL;
 	fsdevice = fstype = mntopts = puffsexec = specopts = NULL;
 	fst = NULL;
 	verbose = fflag = 0;
-	stopopts = 0;
-	memset(&mntd, 0, sizeof(mntd));
-	mntd.mntd_fsdevice = mntd.mntd_canon_dev;
+	stopopts = ndev = 0;
 
-	rump_init();
 	opterr = 0;
 	/*
 	 * [-o mnt_args] [-t fstype] [-p puffsexec] fsdevice
@@ -135,8 +233,12 @@ fsu_mount(int *argc, char **argv[], int mode)
 	while ((ch = getopt(*argc, *argv, options)) != -1) {
 		switch (ch) {
 		case 'f':
-			if (fsdevice == NULL)
-				fsdevice = optarg;
+			if (ndev == FSU_MAXIMAGES) {
+				warnx("at most %d images", FSU_MAXIMAGES);
+				opterr = 1;
+				return -1;
+			}
+			devs[ndev++] = optarg;
 			fflag = 1;
 			break;
 		case 'o':
@@ -188,7 +290,19 @@ fsu_mount(int *argc, char **argv[], int mode)
 	if (mntopts == NULL)
 		mntopts = getenv("FSU_MNTOPTS");
 
-	if (mode == MOUNT_READONLY) {
+	/* none of batch, direct, partition=, overlay=, profile=, sizes */
+	mntopts = mount_imgopts(mntopts, &batch, &direct, &partition,
+	    &overlay, &profile, &ma->ma_tune);
+	if (partition == -1) {
+		opterr = 1;
+		return -1;
+	}
+	tmp = getenv("FSU_DIRECT");
+	if (direct ||
+	    (tmp != NULL && tmp[0] != '\0' && strcmp(tmp, "0") != 0))
+		fsu_direct_enable();
+
+	if (mode & MOUNT_READONLY) {
 		if (mntopts == NULL)
 			mntopts = __UNCONST("ro");
 		else {
@@ -219,7 +333,20 @@ fsu_mount(int *argc, char **argv[], int mode)
 		}
 	}
 
-	if (fsdevice == NULL) {
+	if (ndev > 1 && overlay != NULL) {
+		warnx("overlay: only one image can have an overlay");
+		opterr = 1;
+		return -1;
+	}
+	if (ndev > 1 && profile != NULL) {
+		warnx("profile: only one image can have a profile");
+		opterr = 1;
+		return -1;
+	}
+
+	if (ndev > 0)
+		fsdevice = devs[0];
+	else {
 		fsdevice = getenv("FSU_DEVICE");
 		if (fsdevice == NULL) {
 			if (idx < *argc && strcmp((*argv)[idx], "--") != 0)
@@ -232,50 +359,46 @@ fsu_mount(int *argc, char **argv[], int mode)
 		}
 	}
 
-	rv = 0;
 	if (!fflag) {
-		rv = -1;
 		build_alias_list();
 		alias = get_alias(fsdevice);
-		if (alias != NULL)
-			rv = mount_alias(alias, mntopts, specopts, &mntd,
-			    verbose);
-		free_alias_list();
 	}
-	if (fflag || alias == NULL) {
-		if (realpath(fsdevice, afsdev) != NULL)
-			fsdevice = afsdev;
-		rv = stat(fsdevice, &sb);
-		if (rv == -1)
-			warn("%s", fsdevice);
-		else if (!(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
-			warnx("%s: Not a regular file or block device",
-			    fsdevice);
-			rv = -1;
-		} else {
-			rv = rump_pub_etfs_register(RUMPFSDEV, fsdevice,
-			    RUMP_ETFS_BLK);
-			if (rv != 0) {
-				warnx("%s: rump_pub_etfs_register failed "
-						"(error=%d)", fsdevice, rv);
-			} else {
-				mntd.mntd_fsdevice = fsdevice;
-				fsdevice = strdup(RUMPFSDEV);
-				rv = mount_fstype(fst, fsdevice, mntopts,
-				    puffsexec, specopts, &mntd, verbose);
-				if (rv == -1) {
-					warnx("%s: "
-					    "Invalid or unknown filesystem type"
-					    ", retry with -v for details",
-					    mntd.mntd_fsdevice);
-				}
-			}
+
+	/* size the rump kernel for the images */
+	tunetype = fst != NULL ? fst->fs_name : NULL;
+	imgsize = 0;
+	if (alias != NULL) {
+		tunetype = alias->fsa_type;
+		imgsize = mount_imgsize(alias->fsa_path);
+	} else {
+		if (ndev == 0)
+			devs[ndev++] = fsdevice;
+		for (i = 0; i < ndev; ++i) {
+			devs[i] = mount_spec(devs[i], &devfst[i]);
+			imgsize += mount_imgsize(devs[i]);
 		}
-	}
+		if (devfst[0] != NULL)
+			tunetype = devfst[0]->fs_name;
 
-	free(mntd.mntd_argv);
-	mntd.mntd_argv = NULL;
-	mntd.mntd_argv_size = 0;
+		/* the type is autodetected at mount time, find it now */
+		if (tunetype == NULL)
+			tunetype = mount_imgtype(devs[0], partition);
+	}
+	fsu_tune(&ma->ma_tune, imgsize, tunetype);
+
+	ma->ma_fst = fst;
+	ma->ma_alias = alias;
+	ma->ma_mntopts = mntopts;
+	ma->ma_puffsexec = puffsexec;
+	ma->ma_specopts = specopts;
+	ma->ma_overlay = overlay;
+	ma->ma_profile = profile;
+	ma->ma_ndev = ndev;
+	ma->ma_partition = partition;
+	ma->ma_verbose = verbose;
+	ma->ma_fflag = fflag;
+	ma->ma_batch = batch;
+	pending = true;
 
 	/* Remove the arguments used by fsu_mount and reset getopt*/
 	if ((*argv)[idx] != NULL && strcmp((*argv)[idx], "--") == 0)
@@ -296,13 +419,305 @@ fsu_mount(int *argc, char **argv[], int mode)
 	optreset = 1;
 #endif
 	opterr = 1;
+
+	rv = 0;
+	if (!(mode & MOUNT_DEFER))
+		rv = fsu_mount_now();
+	return rv;
+}
+
+/*
+ * Boots the rump kernel and mounts the images fsu_mount() parsed.
+ * Returns 0 at once when they are already mounted.
+ */
+int
+fsu_mount_now(void)
+{
+	struct mount_args_s *ma;
+	struct mount_data_s mntd;
+	struct timespec ts;
+	char key[32];
+	int i, rv;
+
+	if (mounted)
+		return 0;
+	if (!pending) {
+		errno = ENXIO;
+		return -1;
+	}
+	pending = false;
+	ma = &margs;
+
+	memset(&mntd, 0, sizeof(mntd));
+	mntd.mntd_fsdevice = mntd.mntd_canon_dev;
+	mntd.mntd_batch = ma->ma_batch;
+	strlcpy(mntd.mntd_dir, MOUNT_DIRECTORY, sizeof(mntd.mntd_dir));
+
+	fsu_tune_apply(&ma->ma_tune, ma->ma_verbose);
+
+	fsu_trace_start(&ts);
+	rv = rump_init();
+	fsu_trace_end(&ts, "rump_init", NULL, rv);
+
+	/*
+	 * Switch the default process to the native syscalls, once and
+	 * before any thread can use it.  The process forked for the mount
+	 * and the lwps created by fsu_ctx_open() inherit them.
+	 */
+	rump_i_know_what_i_am_doing_with_sysents = 1;
+	rump_pub_lwproc_sysent_usenative();
+
+	if (ma->ma_alias != NULL) {
+		rv = mount_alias(ma->ma_alias, ma->ma_mntopts,
+		    ma->ma_specopts, &mntd, ma->ma_verbose);
+	} else {
+		for (i = 0, rv = 0; i < ma->ma_ndev && rv == 0; ++i) {
+			mntd.mntd_partition = ma->ma_partition;
+			mntd.mntd_overlay = ma->ma_overlay;
+			mntd.mntd_profile = ma->ma_profile;
+			mntd.mntd_offset = mntd.mntd_size = 0;
+			mntd.mntd_detected = NULL;
+			if (ma->ma_ndev == 1) {
+				mntd.mntd_key = RUMPFSDEV;
+			} else {
+				snprintf(key, sizeof(key), RUMPFSDEV "%d", i);
+				mntd.mntd_key = key;
+				snprintf(mntd.mntd_dir, sizeof(mntd.mntd_dir),
+				    MOUNT_DIRECTORY "/%d", i);
+			}
+			rv = mount_image(ma->ma_devs[i],
+			    ma->ma_devfst[i] != NULL ? ma->ma_devfst[i] :
+			    ma->ma_fst, ma->ma_mntopts, ma->ma_puffsexec,
+			    ma->ma_specopts, &mntd, ma->ma_verbose);
+		}
+	}
+	if (!ma->ma_fflag)
+		free_alias_list();
+	ma->ma_alias = NULL;
+
+	if (rv == 0)
+		rv = mount_chroot();
+	else {
+		/* all or nothing */
+		while (nimages > 0)
+			rump_sys_unmount(images[--nimages].mi_dir, 0);
+	}
+
+	free(mntd.mntd_argv);
+	mntd.mntd_argv = NULL;
+	mntd.mntd_argv_size = 0;
+
+	return rv;
+}
+
+/*
+ * Registers the image at fsdevice with etfs and mounts it, at the
+ * partition, with the overlay, under the key and on the directory
+ * given in mntdp.
+ */
+static int
+mount_image(char *fsdevice, fsu_fs_t *fst, char *mntopts, char *puffsexec,
+    char *specopts, struct mount_data_s *mntdp, int verbose)
+{
+	char afsdev[PATH_MAX], pfsdev[PATH_MAX], *romntopts;
+	const char *fmt, *why;
+	struct stat sb;
+	struct timespec ts;
+	uint64_t isize;
+	int rv;
+
+	/* image@pN, unless a file is named like that */
+	if (stat(fsdevice, &sb) == -1) {
+		rv = fsu_part_split(fsdevice, pfsdev, sizeof(pfsdev));
+		if (rv > 0) {
+			fsdevice = pfsdev;
+			mntdp->mntd_partition = rv;
+		}
+	}
+	if (realpath(fsdevice, afsdev) != NULL)
+		fsdevice = afsdev;
+	rv = stat(fsdevice, &sb);
+	if (rv == -1) {
+		warn("%s", fsdevice);
+		return -1;
+	}
+	if (!(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		warnx("%s: Not a regular file or block device", fsdevice);
+		return -1;
+	}
+
+	/* qcow2 and seekable zstd images are read-only, but for an overlay */
+	fmt = NULL;
+	romntopts = NULL;
+	if (S_ISREG(sb.st_mode)) {
+		fmt = fsu_image_format(fsdevice, &isize, &why);
+		if (fmt == NULL && errno != 0) {
+			warnx("%s: %s", fsdevice, why);
+			return -1;
+		}
+	}
+	if (fmt != NULL) {
+#ifdef NO_COMPONENT_DLOPEN
+		warnx("%s: %s images need a dynamically linked rump kernel",
+		    fsdevice, fmt);
+		return -1;
+#else
+		if (verbose)
+			printf("%s: %s image of %" PRIu64 " bytes\n",
+			    fsdevice, fmt, isize);
+		if (mntdp->mntd_overlay == NULL) {
+			romntopts = malloc(mntopts != NULL ?
+			    strlen(mntopts) + 4 : 3);
+			if (romntopts == NULL) {
+				warn(NULL);
+				return -1;
+			}
+			if (mntopts != NULL)
+				sprintf(romntopts, "%s,ro", mntopts);
+			else
+				strcpy(romntopts, "ro");
+			mntopts = romntopts;
+		}
+#endif
+	}
+
+	if (mntdp->mntd_partition > 0 && fsu_part_find(fsdevice,
+	    mntdp->mntd_partition, &mntdp->mntd_offset,
+	    &mntdp->mntd_size) == -1) {
+		free(romntopts);
+		return -1;
+	}
+
+	if (mntdp->mntd_overlay != NULL)
+		fsu_overlay_enable(mntdp->mntd_overlay);
+	if (mntdp->mntd_profile != NULL)
+		fsu_prefetch_enable(mntdp->mntd_profile);
+	fsu_trace_start(&ts);
+	if (mntdp->mntd_partition > 0)
+		rv = rump_pub_etfs_register_withsize(mntdp->mntd_key,
+		    fsdevice, RUMP_ETFS_BLK, mntdp->mntd_offset,
+		    mntdp->mntd_size);
+	else
+		rv = rump_pub_etfs_register(mntdp->mntd_key, fsdevice,
+		    RUMP_ETFS_BLK);
+	fsu_trace_end(&ts, "etfs_register", NULL, rv);
+	if (rv != 0) {
+		warnx("%s: rump_pub_etfs_register failed (error=%d)",
+		    fsdevice, rv);
+		free(romntopts);
+		return -1;
+	}
+
+	mntdp->mntd_fsdevice = fsdevice;
+	rv = mount_fstype(fst, strdup(mntdp->mntd_key), mntopts, puffsexec,
+	    specopts, mntdp, verbose);
+	free(romntopts);
+	if (rv == -1) {
+		warnx("%s: Invalid or unknown filesystem type"
+		    ", retry with -v for details", fsdevice);
+		rump_pub_etfs_remove(mntdp->mntd_key);
+		return -1;
+	}
+
+	images[nimages - 1].mi_fstype = mntdp->mntd_detected;
+	free(mntdp->mntd_argv);
+	mntdp->mntd_argv = NULL;
+	mntdp->mntd_argv_size = 0;
+	return 0;
+}
+
+/*
+ * Size of the image at path, or of the whole disk for image@pN, 0 if
+ * not known.  That of a qcow2 or zstd image is what it holds.
+ */
+static uint64_t
+mount_imgsize(const char *path)
+{
+	char buf[PATH_MAX];
+	struct stat sb;
+	uint64_t size;
+
+	if (stat(path, &sb) == -1) {
+		if (fsu_part_split(path, buf, sizeof(buf)) <= 0 ||
+		    stat(buf, &sb) == -1)
+			return 0;
+		path = buf;
+	}
+	if (!S_ISREG(sb.st_mode))
+		return 0;
+	if (fsu_image_format(path, &size, NULL) != NULL)
+		return size;
+	return sb.st_size;
+}
+
+/*
+ * Type of the file system in the image at path, or in its partition
+ * for image@pN or -o partition=N, as mount_fstype() would detect it
+ * but on the host.  NULL if not known.
+ */
+static const char *
+mount_imgtype(const char *path, int partition)
+{
+	char buf[PATH_MAX], apath[PATH_MAX];
+	struct stat sb;
+	const char *rv;
+	off_t off, size;
+
+	if (stat(path, &sb) == -1) {
+		partition = fsu_part_split(path, buf, sizeof(buf));
+		if (partition <= 0)
+			return NULL;
+		path = buf;
+	}
+	/* the cache knows the image by its real path */
+	if (realpath(path, apath) != NULL)
+		path = apath;
+
+	off = size = 0;
+	if (partition > 0 && fsu_part_find(path, partition, &off, &size) == -1)
+		return NULL;
+	rv = fsu_cache_lookup(path, off);
+	if (rv == NULL)
+		rv = fsu_probe(path, off, size);
 	return rv;
 }
 
+/*
+ * Splits "image:fstype" when there is no file of that name and fstype
+ * is supported.
+ */
+static char *
+mount_spec(char *spec, fsu_fs_t **fstp)
+{
+	fsu_fs_t *fs;
+	struct stat sb;
+	char *p, *dev;
+
+	*fstp = NULL;
+	p = strrchr(spec, ':');
+	if (p == NULL || stat(spec, &sb) == 0)
+		return spec;
+
+	for (fs = fslist; fs->fs_name != NULL; ++fs)
+		if (strcmp(p + 1, fs->fs_name) == 0)
+			break;
+	if (fs->fs_name == NULL)
+		return spec;
+
+	dev = strndup(spec, p - spec);
+	if (dev == NULL)
+		return spec;
+	*fstp = fs;
+	return dev;
+}
+
 static int
 mount_fstype(fsu_fs_t *fs, const char *fsdev, char *mntopts, char *puffsexec,
     char *specopts, struct mount_data_s *mntdp, int verbose)
 {
+	const char *cached, *probed;
+	fsu_fs_t *cachedfs, *probedfs;
+	struct timespec ts;
 	int argvlen;
 
 	mntdp->mntd_fs = fs;
@@ -352,16 +767,73 @@ mount_fstype(fsu_fs_t *fs, const char *fsdev, char *mntopts, char *puffsexec,
 	if (fs != NULL)
 		return mount_struct(verbose, mntdp);
 
-	/* filesystem not given (auto detection) */
+	/*
+	 * filesystem not given (auto detection)
+	 * use the type found by an earlier run if the image is unchanged
+	 */
+	cachedfs = probedfs = NULL;
+	fsu_trace_start(&ts);
+	cached = fsu_cache_lookup(mntdp->mntd_fsdevice, mntdp->mntd_offset);
+	fsu_trace_end(&ts, "cache_lookup", cached, cached == NULL);
+	if (cached != NULL) {
+		for (fs = fslist; fs->fs_name != NULL; ++fs)
+			if (strcmp(fs->fs_name, cached) == 0)
+				break;
+
+		if (fs->fs_name != NULL) {
+			if (verbose)
+				printf("Cached fs %s\n", fs->fs_name);
+			cachedfs = fs;
+			mntdp->mntd_fs = fs;
+			if (mount_struct(verbose, mntdp) == 0) {
+				mntdp->mntd_detected = fs->fs_name;
+				return 0;
+			}
+			mntdp->mntd_flags = 0;
+		}
+	}
+
+	/*
+	 * if the image has a known signature, try that type first; the
+	 * probe may be fooled by a stale superblock, so go on with the
+	 * others if it fails
+	 */
+	fsu_trace_start(&ts);
+	probed = fsu_probe(mntdp->mntd_fsdevice, mntdp->mntd_offset,
+	    mntdp->mntd_size);
+	fsu_trace_end(&ts, "probe", probed, probed == NULL);
+	if (probed != NULL) {
+		for (fs = fslist; fs->fs_name != NULL; ++fs)
+			if (strcmp(fs->fs_name, probed) == 0)
+				break;
+
+		if (fs->fs_name != NULL && fs != cachedfs) {
+			if (verbose)
+				printf("Detected fs %s\n", fs->fs_name);
+			probedfs = fs;
+			mntdp->mntd_fs = fs;
+			if (mount_struct(verbose, mntdp) == 0) {
+				mntdp->mntd_detected = fs->fs_name;
+				return 0;
+			}
+			mntdp->mntd_flags = 0;
+		}
+	}
+
+	/* no signature found or it did not mount, try every other type */
 	for (fs = fslist; fs->fs_name != NULL; ++fs) {
+		if (fs == cachedfs || fs == probedfs)
+			continue;
 		if (verbose)
 			printf("Trying with fs %s\n", fs->fs_name);
 		if (fs->fs_flags & FS_NO_AUTO)
 			continue;
 		mntdp->mntd_flags = 0;
 		mntdp->mntd_fs = fs;
-		if (mount_struct(verbose > 1, mntdp) == 0)
+		if (mount_struct(verbose > 1, mntdp) == 0) {
+			mntdp->mntd_detected = fs->fs_name;
 			return 0;
+		}
 	}
 	return -1;
 }
@@ -431,37 +903,124 @@ mount_alias(struct fsu_fsalias_s *al, char *mntopts, char *specopts,
 	return mount_struct(verbose, mntdp);
 }
 
+/*
+ * Returns the mount options without those about the image: "batch",
+ * set in *batch, "direct", set in *direct, "partition=N", set in
+ * *partition (0 if not given), "overlay=delta", set in *overlay,
+ * "profile=file", set in *profile, and the sizes of the rump kernel,
+ * set in *tune.  *partition is -1 if any of them is invalid.
+ */
+static char *
+mount_imgopts(char *mntopts, bool *batch, bool *direct, int *partition,
+    char **overlay, char **profile, struct fsu_tune_s *tune)
+{
+	char *opts, *copy, *p, *o, *ep;
+	bool found;
+	long n;
+	int rv;
+
+	*batch = *direct = false;
+	*partition = 0;
+	*overlay = *profile = NULL;
+	memset(tune, 0, sizeof(*tune));
+	if (mntopts == NULL)
+		return NULL;
+
+	opts = malloc(strlen(mntopts) + 1);
+	copy = strdup(mntopts);
+	if (opts == NULL || copy == NULL) {
+		free(opts);
+		free(copy);
+		return mntopts;
+	}
+
+	found = false;
+	opts[0] = '\0';
+	for (p = copy; (o = strsep(&p, ",")) != NULL;) {
+		if (strcmp(o, "batch") == 0) {
+			*batch = found = true;
+		} else if (strcmp(o, "direct") == 0) {
+			*direct = found = true;
+		} else if (strncmp(o, "partition=", 10) == 0) {
+			errno = 0;
+			n = strtol(o + 10, &ep, 10);
+			if (errno != 0 || *ep != '\0' || n <= 0 ||
+			    n > INT_MAX) {
+				warnx("%s: invalid partition", o + 10);
+				*partition = -1;
+			} else if (*partition != -1)
+				*partition = n;
+			found = true;
+		} else if ((rv = fsu_tune_parse(o, tune)) != 0) {
+			if (rv == -1)
+				*partition = -1;
+			found = true;
+		} else if (strncmp(o, "overlay=", 8) == 0) {
+			/* points into copy, which is kept */
+			*overlay = o + 8;
+			found = true;
+		} else if (strncmp(o, "profile=", 8) == 0) {
+			*profile = o + 8;
+			found = true;
+		} else if (o[0] != '\0') {
+			if (opts[0] != '\0')
+				strcat(opts, ",");
+			strcat(opts, o);
+		}
+	}
+	if (*overlay == NULL && *profile == NULL)
+		free(copy);
+
+	if (!found) {
+		free(opts);
+		return mntopts;
+	}
+	if (opts[0] == '\0') {
+		free(opts);
+		return NULL;
+	}
+	return opts;
+}
+
 static int
 mount_struct(_Bool verbose, struct mount_data_s *mntdp)
 {
+	struct mount_image_s *mi;
 	fsu_fs_t *fs;
+	struct timespec ts;
 	int rv;
 
 	fs = mntdp->mntd_fs;
 
-	/*
-	 * Switch the default process to the native syscalls.
-	 * The bad thing about this is that it will fail in unobvious
-	 * way if programs using this go multithreaded, but worry about
-	 * that if it happens.
-	 */
-	rump_i_know_what_i_am_doing_with_sysents = 1;
-	rump_pub_lwproc_sysent_usenative();
-
+	fsu_trace_start(&ts);
 	rv = fs->fs_parseargs(mntdp->mntd_argc, mntdp->mntd_argv, fs->fs_args,
 	    &(mntdp->mntd_flags), mntdp->mntd_canon_dev, mntdp->mntd_canon_dir);
+	fsu_trace_end(&ts, "parseargs", fs->fs_name, rv);
 	if (rv != 0)
 		return -1;
 
+	/* metadata reaches the image when unmounting, unless journaled */
+	if (mntdp->mntd_batch &&
+	    (mntdp->mntd_flags & (MNT_RDONLY | MNT_LOG)) == 0)
+		mntdp->mntd_flags |= MNT_ASYNC;
+
 	if (rump_sys_mkdir(MOUNT_DIRECTORY, 0777) == -1 && errno != EEXIST)
 		err(-1, "mkdir");
-	strcpy(mntdp->mntd_canon_dir, MOUNT_DIRECTORY);
+	if (strcmp(mntdp->mntd_dir, MOUNT_DIRECTORY) != 0 &&
+	    rump_sys_mkdir(mntdp->mntd_dir, 0777) == -1 && errno != EEXIST)
+		err(-1, "mkdir");
+	strlcpy(mntdp->mntd_canon_dir, mntdp->mntd_dir,
+	    sizeof(mntdp->mntd_canon_dir));
 
+	fsu_trace_start(&ts);
 	rv = fsu_load_fs(fs->fs_name);
+	fsu_trace_end(&ts, "load_fs", fs->fs_name, rv == 0 ? 0 : errno);
 
 	if (rv == 0) {
+		fsu_trace_start(&ts);
 		rv = rump_sys_mount(fs->fs_name, mntdp->mntd_canon_dir,
 		    mntdp->mntd_flags, fs->fs_args, fs->fs_args_size);
+		fsu_trace_end(&ts, "mount", fs->fs_name, rv == 0 ? 0 : errno);
 #if 0
 		/*
 		 * This will result in a lot of spam for fs type autodetection,
@@ -473,14 +1032,15 @@ mount_struct(_Bool verbose, struct mount_data_s *mntdp)
 	}
 
 	if (rv == 0) {
-		/* fork a rump kernel process to chroot() to the mountpoint */
-		if ((rv = rump_pub_lwproc_rfork(RUMP_RFCFDG)) != 0) {
-			warnx("fork failed!");
-			rump_sys_unmount(MOUNT_DIRECTORY, 0);
-		} else {
-			atexit(fsu_unmount);
-			rump_sys_chroot(MOUNT_DIRECTORY);
-		}
+		mi = &images[nimages++];
+		strlcpy(mi->mi_dir, mntdp->mntd_dir, sizeof(mi->mi_dir));
+		strlcpy(mi->mi_dev, mntdp->mntd_fsdevice, sizeof(mi->mi_dev));
+		mi->mi_off = mntdp->mntd_offset;
+		mi->mi_part = mntdp->mntd_partition;
+		mi->mi_batch = mntdp->mntd_batch &&
+		    (mntdp->mntd_flags & MNT_RDONLY) == 0;
+		mi->mi_fstype = NULL;
+		mount_batch(mi);
 	}
 #ifdef WITH_SMBFS
 	if (strcmp(fs->fs_name, MOUNT_SMBFS) == 0) {
@@ -498,9 +1058,124 @@ mount_struct(_Bool verbose, struct mount_data_s *mntdp)
 	return rv;
 }
 
+/*
+ * Forks a rump kernel process to chroot() to the mountpoint, above the
+ * images if there are several.
+ */
+static int
+mount_chroot(void)
+{
+	struct timespec ts;
+	int rv;
+
+	fsu_trace_start(&ts);
+	if ((rv = rump_pub_lwproc_rfork(RUMP_RFCFDG)) != 0) {
+		warnx("fork failed!");
+		while (nimages > 0)
+			rump_sys_unmount(images[--nimages].mi_dir, 0);
+	} else {
+		atexit(fsu_unmount);
+		rump_sys_chroot(MOUNT_DIRECTORY);
+		mount_pid = rump_sys_getpid();
+		mounted = true;
+	}
+	fsu_trace_end(&ts, "rfork_chroot", NULL, rv);
+	return rv;
+}
+
+/*
+ * Gives the calling thread an lwp of its own in the process chrooted to
+ * the mount, so that it can issue rump_sys_*() calls while others do.
+ * The threads share the descriptors and the working directory, as the
+ * threads of a process do.  The context must be closed by the thread
+ * that opened it, and every context before fsu_unmount().
+ */
+struct fsu_ctx *
+fsu_ctx_open(void)
+{
+	struct fsu_ctx *ctx;
+	int rv;
+
+	if (!mounted) {
+		errno = ENXIO;
+		return NULL;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+
+	ctx->fc_prev = rump_pub_lwproc_curlwp();
+	ctx->fc_pid = 0;
+	rv = rump_pub_lwproc_newlwp(mount_pid);
+	if (rv != 0) {
+		free(ctx);
+		errno = rv;
+		return NULL;
+	}
+	ctx->fc_lwp = rump_pub_lwproc_curlwp();
+	return ctx;
+}
+
+/*
+ * Runs the calling thread in a rump process of its own, forked from the
+ * one chrooted to the mount with a copy of its descriptors and working
+ * directory, until fsu_ctx_close().  The contexts opened meanwhile are
+ * lwps of that process, and the descriptors it leaves open are closed
+ * with it.  A batch runs each of its commands this way.
+ */
+struct fsu_ctx *
+fsu_proc_open(void)
+{
+	struct fsu_ctx *ctx;
+	int rv;
+
+	if (!mounted) {
+		errno = ENXIO;
+		return NULL;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+
+	ctx->fc_prev = rump_pub_lwproc_curlwp();
+	ctx->fc_pid = mount_pid;
+	rv = rump_pub_lwproc_rfork(RUMP_RFFDG);
+	if (rv != 0) {
+		free(ctx);
+		errno = rv;
+		return NULL;
+	}
+	ctx->fc_lwp = rump_pub_lwproc_curlwp();
+	mount_pid = rump_sys_getpid();
+	return ctx;
+}
+
+void
+fsu_ctx_close(struct fsu_ctx *ctx)
+{
+
+	if (ctx == NULL)
+		return;
+
+	if (rump_pub_lwproc_curlwp() != ctx->fc_lwp)
+		rump_pub_lwproc_switch(ctx->fc_lwp);
+	rump_pub_lwproc_releaselwp();
+	if (ctx->fc_prev != NULL)
+		rump_pub_lwproc_switch(ctx->fc_prev);
+	if (ctx->fc_pid != 0)
+		mount_pid = ctx->fc_pid;
+	free(ctx);
+}
+
 void
 fsu_unmount(void)
 {
+	struct mount_image_s *mi;
+	struct timespec ts;
+	char sidecar[PATH_MAX + 32];
+	int i, rv;
 
 	/*
 	 * Release the emulated process.  This:
@@ -508,8 +1183,90 @@ fsu_unmount(void)
 	 *   2) gives us a native process context so we can umount()
 	 */
 	rump_pub_lwproc_releaselwp();
-	if (rump_sys_unmount(MOUNT_DIRECTORY, 0) != 0)
-		warnx("unmount failed, image may be dirty!");
+
+	/* the one write back of a batch session */
+	for (i = 0; i < nimages; ++i) {
+		if (images[i].mi_batch) {
+			fsu_trace_start(&ts);
+			rump_sys_sync();
+			fsu_trace_end(&ts, "sync", NULL, 0);
+			break;
+		}
+	}
+
+	while (nimages > 0) {
+		mi = &images[--nimages];
+		fsu_trace_start(&ts);
+		rv = rump_sys_unmount(mi->mi_dir, 0);
+		fsu_trace_end(&ts, "unmount", mi->mi_dir, rv == 0 ? 0 : errno);
+		if (rv != 0) {
+			warnx("%s: unmount failed, image may be dirty!",
+			    mi->mi_dev);
+			continue;
+		}
+		if (mi->mi_batch) {
+			mount_sidecar(mi, sidecar, sizeof(sidecar));
+			unlink(sidecar);
+		}
+		if (mi->mi_fstype != NULL)
+			/* the image will not change anymore */
+			fsu_cache_store(mi->mi_dev, mi->mi_off, mi->mi_fstype);
+	}
+}
+
+/*
+ * Name of the file marking a batch session on the image of mi.
+ */
+static void
+mount_sidecar(struct mount_image_s *mi, char *buf, size_t len)
+{
+
+	if (mi->mi_part > 0)
+		snprintf(buf, len, "%s@p%d.batch", mi->mi_dev, mi->mi_part);
+	else
+		snprintf(buf, len, "%s.batch", mi->mi_dev);
+}
+
+/*
+ * Warns about a batch session on the image of mi that did not get to
+ * unmount it, and marks the image for this one.  The mark stays until
+ * the image is unmounted, so that a session that dies leaves it behind.
+ */
+static void
+mount_batch(struct mount_image_s *mi)
+{
+	char sidecar[PATH_MAX + 32], buf[128];
+	ssize_t n;
+	int fd;
+
+	mount_sidecar(mi, sidecar, sizeof(sidecar));
+	fd = open(sidecar, O_RDONLY);
+	if (fd != -1) {
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		buf[n > 0 ? n : 0] = '\0';
+		buf[strcspn(buf, "\n")] = '\0';
+		warnx("%s: a batch session (%s) did not finish, the image "
+		    "may be inconsistent; remove %s once it is checked",
+		    mi->mi_dev, buf, sidecar);
+		/* still dirty, keep the mark of the session that died */
+		mi->mi_batch = false;
+		return;
+	}
+
+	if (!mi->mi_batch)
+		return;
+
+	fd = open(sidecar, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		warn("%s", sidecar);
+		return;
+	}
+	n = snprintf(buf, sizeof(buf), "%s pid %ld\n", getprogname(),
+	    (long)getpid());
+	if (write(fd, buf, n) != n || fsync(fd) == -1)
+		warn("%s", sidecar);
+	close(fd);
 }
 
 const char *
@@ -517,11 +1274,35 @@ fsu_mount_usage(void)
 {
 
 #ifdef WITH_SYSPUFFS
-	return "[-o mnt_args] [-s specopts] [-t fstype] [-p puffs_exec] [-f] fsdevice";
+	return "[-o mnt_args] [-s specopts] [-t fstype] [-p puffs_exec] "
+	    "[-f fsdevice[:fstype] ...] fsdevice";
 #else
-	return "[-o mnt_args] [-s specopts] [-t fstype] [-f] fsdevice";
+	return "[-o mnt_args] [-s specopts] [-t fstype] "
+	    "[-f fsdevice[:fstype] ...] fsdevice";
+#endif
+}
+
+#ifndef NO_COMPONENT_DLOPEN
+/*
+ * Tells if the component for fsname is linked in (--with-static-fs),
+ * rump_init() has then already set up the modules of its link set.
+ */
+static bool
+fsu_linked_fs(const char *fsname)
+{
+#ifdef FSU_STATIC_FS
+	static const char linked[] = "," FSU_STATIC_FS ",";
+	const char *p;
+	size_t len;
+
+	len = strlen(fsname);
+	for (p = linked + 1; (p = strstr(p, fsname)) != NULL; p += len)
+		if (p[-1] == ',' && p[len] == ',')
+			return true;
 #endif
+	return false;
 }
+#endif
 
 static int
 fsu_load_fs(const char *fsname)
@@ -534,6 +1315,9 @@ fsu_load_fs(const char *fsname)
 	const struct modinfo *const *mi_start, *const *mi_end;
 	int error;
 
+	if (fsu_linked_fs(fsname))
+		return 0;
+
 	snprintf(fname, sizeof(fname) - 1, "librumpfs_%s.so", fsname);
 	handle = dlopen(fname, RTLD_LAZY|RTLD_GLOBAL);
 	if (handle == NULL)
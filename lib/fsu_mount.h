@@ -32,9 +32,17 @@
 
 #define MOUNT_READWRITE 0
 #define MOUNT_READONLY 1
+#define MOUNT_DEFER 2		/* mount on fsu_mount_now() */
+
+struct fsu_ctx;
 
 int		fsu_mount(int *, char **[], int);
+int		fsu_mount_now(void);
 const char	*fsu_mount_usage(void);
 void		fsu_unmount(void);
 
+struct fsu_ctx	*fsu_ctx_open(void);
+struct fsu_ctx	*fsu_proc_open(void);
+void		fsu_ctx_close(struct fsu_ctx *);
+
 #endif
@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Copy-on-write overlay for the image, enabled with -o overlay=<delta>.
+ *
+ * The image is opened read-only and every block written to it goes to
+ * the delta file instead, at the same offset past the header, so that
+ * the delta stays sparse and costs nothing to set up.  A bitmap after
+ * the header tells which blocks are in the delta:
+ *
+ *	0		header: OV_MAGIC, block size, image size (LE)
+ *	OV_HDRSIZE	bitmap, one bit per block, padded to OV_HDRSIZE
+ *	ov_dataoff	the blocks
+ *
+ * A write that covers part of a block not yet in the delta copies the
+ * rest of the block up from the image first.  The bitmap is written
+ * after the data it describes, on synchronous writes, on close and when
+ * the program exits.  fsu_merge(1) applies a delta to its image.
+ *
+ * The blocks of an image in one of the formats of fsu_image.c are those
+ * it holds, its delta is merged into a new raw image only.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#define OV_MAGIC	"FSUCOW01"
+#define OV_BSIZE	4096
+#define OV_HDRSIZE	4096
+#define OV_COPY		(1024 * 1024)	/* merge buffer */
+
+struct ov_image {
+	int		ov_fd;		/* image, -1 when free */
+	int		ov_dfd;		/* delta */
+	uint64_t	ov_size;	/* of the image */
+	uint64_t	ov_dataoff;
+	uint8_t		*ov_map;
+	size_t		ov_maplen;
+	bool		ov_mapdirty;
+};
+
+static pthread_mutex_t ov_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct ov_image ov_image = { -1, -1, 0, 0, NULL, 0, false };
+static uint8_t ov_blk[OV_BSIZE];
+static char *ov_delta;			/* for the next image opened */
+
+#define OV_ISSET(ov, b)	((ov)->ov_map[(b) / 8] & (1 << ((b) % 8)))
+#define OV_SET(ov, b)	((ov)->ov_map[(b) / 8] |= (1 << ((b) % 8)))
+
+static void	le32enc(uint8_t *, uint32_t);
+static void	le64enc(uint8_t *, uint64_t);
+static uint32_t	le32dec(const uint8_t *);
+static uint64_t	le64dec(const uint8_t *);
+static int	ov_load(struct ov_image *, int, uint64_t, bool);
+static int	ov_writemap(struct ov_image *);
+static int	ov_read(struct ov_image *, uint8_t *, size_t, uint64_t,
+		    size_t *);
+static int	ov_write(struct ov_image *, const uint8_t *, size_t,
+		    uint64_t, size_t *);
+static int	ov_copy(int, int, uint64_t, uint64_t, uint64_t, uint8_t *);
+static void	ov_exit(void);
+
+static void
+le32enc(uint8_t *p, uint32_t v)
+{
+
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void
+le64enc(uint8_t *p, uint64_t v)
+{
+
+	le32enc(p, v);
+	le32enc(p + 4, v >> 32);
+}
+
+static uint32_t
+le32dec(const uint8_t *p)
+{
+
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+le64dec(const uint8_t *p)
+{
+
+	return le32dec(p) | (uint64_t)le32dec(p + 4) << 32;
+}
+
+/*
+ * Have the next image opened for block I/O go through the delta at
+ * path, created if it does not exist.
+ */
+void
+fsu_overlay_enable(const char *path)
+{
+
+	free(ov_delta);
+	ov_delta = strdup(path);
+	if (ov_delta == NULL)
+		warn(NULL);
+}
+
+bool
+fsu_overlay_wanted(void)
+{
+
+	return ov_delta != NULL;
+}
+
+/*
+ * Puts the delta in front of the image just opened on fd.  Returns 0,
+ * also when no overlay is wanted, or an errno.
+ */
+int
+fsu_overlay_open(int fd)
+{
+	struct ov_image *ov;
+	uint64_t size;
+	int dfd, error;
+	bool created;
+
+	if (ov_delta == NULL)
+		return 0;
+
+	ov = &ov_image;
+	if (ov->ov_fd != -1) {
+		warnx("%s: only one image can have an overlay", ov_delta);
+		return EBUSY;
+	}
+	if (fsu_image_size(fd, &size) == -1)
+		return errno;
+
+	created = false;
+	dfd = open(ov_delta, O_RDWR);
+	if (dfd == -1 && errno == ENOENT) {
+		dfd = open(ov_delta, O_RDWR | O_CREAT | O_EXCL, 0644);
+		created = true;
+	}
+	if (dfd == -1) {
+		error = errno;
+		warn("%s", ov_delta);
+		return error;
+	}
+
+	error = ov_load(ov, dfd, size, created);
+	if (error != 0) {
+		if (error != EINVAL) {
+			errno = error;
+			warn("%s", ov_delta);
+		}
+		close(dfd);
+		if (created)
+			unlink(ov_delta);
+		return error;
+	}
+
+	ov->ov_fd = fd;
+	atexit(ov_exit);
+	free(ov_delta);
+	ov_delta = NULL;
+	return 0;
+}
+
+bool
+fsu_overlay_fd(int fd)
+{
+
+	return fd != -1 && ov_image.ov_fd == fd;
+}
+
+int
+fsu_overlay_io(int fd, int op, void *data, size_t dlen, int64_t off,
+    size_t *done)
+{
+	struct ov_image *ov;
+	int error;
+
+	*done = 0;
+	if (off < 0)
+		return EINVAL;
+
+	ov = &ov_image;
+	pthread_mutex_lock(&ov_mtx);
+	if (op & RUMPUSER_BIO_WRITE) {
+		error = ov_write(ov, data, dlen, off, done);
+		if (error == 0 && (op & RUMPUSER_BIO_SYNC)) {
+			if (fdatasync(ov->ov_dfd) == -1)
+				error = errno;
+			else
+				error = ov_writemap(ov);
+		}
+	} else
+		error = ov_read(ov, data, dlen, off, done);
+	pthread_mutex_unlock(&ov_mtx);
+
+	return error;
+}
+
+void
+fsu_overlay_close(int fd)
+{
+	struct ov_image *ov;
+
+	ov = &ov_image;
+	pthread_mutex_lock(&ov_mtx);
+	if (ov->ov_fd == fd && fd != -1) {
+		if (ov_writemap(ov) != 0)
+			warnx("overlay: cannot write the block map");
+		close(ov->ov_dfd);
+		free(ov->ov_map);
+		ov->ov_fd = ov->ov_dfd = -1;
+		ov->ov_map = NULL;
+	}
+	pthread_mutex_unlock(&ov_mtx);
+}
+
+/*
+ * Reads the header and bitmap of the delta on dfd made for an image of
+ * the given size, or writes them to a new one.
+ */
+static int
+ov_load(struct ov_image *ov, int dfd, uint64_t size, bool create)
+{
+	uint8_t hdr[OV_HDRSIZE];
+	uint64_t nblk;
+	ssize_t n;
+
+	nblk = howmany(size, OV_BSIZE);
+	ov->ov_size = size;
+	ov->ov_dfd = dfd;
+	ov->ov_maplen = howmany(nblk, 8);
+	ov->ov_dataoff = OV_HDRSIZE + roundup(ov->ov_maplen, OV_HDRSIZE);
+	ov->ov_map = calloc(1, ov->ov_maplen + 1);
+	if (ov->ov_map == NULL)
+		return errno;
+
+	if (create) {
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(hdr, OV_MAGIC, 8);
+		le32enc(hdr + 8, OV_BSIZE);
+		le64enc(hdr + 16, size);
+		if (pwrite(dfd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+		    ftruncate(dfd, ov->ov_dataoff + size) == -1)
+			goto fail;
+		ov->ov_mapdirty = true;
+		return 0;
+	}
+
+	n = pread(dfd, hdr, sizeof(hdr), 0);
+	if (n == -1)
+		goto fail;
+	if (n != sizeof(hdr) || memcmp(hdr, OV_MAGIC, 8) != 0 ||
+	    le32dec(hdr + 8) != OV_BSIZE) {
+		warnx("overlay: not a delta file");
+		free(ov->ov_map);
+		return EINVAL;
+	}
+	if (le64dec(hdr + 16) != size) {
+		warnx("overlay: the delta is for an image of %llu bytes",
+		    (unsigned long long)le64dec(hdr + 16));
+		free(ov->ov_map);
+		return EINVAL;
+	}
+	n = pread(dfd, ov->ov_map, ov->ov_maplen, OV_HDRSIZE);
+	if (n == -1)
+		goto fail;
+	if ((size_t)n != ov->ov_maplen) {
+		free(ov->ov_map);
+		return EIO;
+	}
+	ov->ov_mapdirty = false;
+	return 0;
+
+fail:
+	n = errno;
+	free(ov->ov_map);
+	return n;
+}
+
+static int
+ov_writemap(struct ov_image *ov)
+{
+
+	if (!ov->ov_mapdirty)
+		return 0;
+	if (pwrite(ov->ov_dfd, ov->ov_map, ov->ov_maplen, OV_HDRSIZE) !=
+	    (ssize_t)ov->ov_maplen || fdatasync(ov->ov_dfd) == -1)
+		return errno != 0 ? errno : EIO;
+	ov->ov_mapdirty = false;
+	return 0;
+}
+
+/* runs of blocks from the same file are read in one go */
+static int
+ov_read(struct ov_image *ov, uint8_t *data, size_t dlen, uint64_t off,
+    size_t *done)
+{
+	uint64_t blk, end, pos;
+	size_t len;
+	ssize_t n;
+	bool indelta;
+
+	if (off >= ov->ov_size)
+		return 0;
+	dlen = MIN(dlen, ov->ov_size - off);
+
+	while (*done < dlen) {
+		pos = off + *done;
+		blk = pos / OV_BSIZE;
+		indelta = OV_ISSET(ov, blk) != 0;
+		end = (blk + 1) * OV_BSIZE;
+		while (end < off + dlen &&
+		    (OV_ISSET(ov, end / OV_BSIZE) != 0) == indelta)
+			end += OV_BSIZE;
+		len = MIN(end, off + dlen) - pos;
+
+		if (indelta)
+			n = pread(ov->ov_dfd, data + *done, len,
+			    ov->ov_dataoff + pos);
+		else
+			n = fsu_image_pread(ov->ov_fd, data + *done, len,
+			    pos);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			return EIO;
+		*done += n;
+	}
+	return 0;
+}
+
+static int
+ov_write(struct ov_image *ov, const uint8_t *data, size_t dlen,
+    uint64_t off, size_t *done)
+{
+	uint64_t blk, pos, bpos, end;
+	size_t len, boff, blen, run, next;
+	ssize_t n;
+
+	if (off + dlen > ov->ov_size)
+		return EINVAL;
+
+	while (*done < dlen) {
+		pos = off + *done;
+		blk = pos / OV_BSIZE;
+		boff = pos % OV_BSIZE;
+		len = MIN(OV_BSIZE - boff, dlen - *done);
+
+		/* part of a block only in the image: copy it up */
+		if (!OV_ISSET(ov, blk) && len != OV_BSIZE) {
+			bpos = blk * OV_BSIZE;
+			blen = MIN(OV_BSIZE, ov->ov_size - bpos);
+			memset(ov_blk, 0, OV_BSIZE);
+			n = fsu_image_pread(ov->ov_fd, ov_blk, blen, bpos);
+			if (n == -1)
+				return errno;
+			if ((size_t)n != blen)
+				return EIO;
+			memcpy(ov_blk + boff, data + *done, len);
+			n = pwrite(ov->ov_dfd, ov_blk, blen,
+			    ov->ov_dataoff + bpos);
+			if (n == -1)
+				return errno;
+			if ((size_t)n != blen)
+				return EIO;
+			OV_SET(ov, blk);
+			ov->ov_mapdirty = true;
+			*done += len;
+			continue;
+		}
+
+		/* whole blocks and blocks in the delta go there directly */
+		run = len;
+		while (run < dlen - *done) {
+			next = MIN(OV_BSIZE, dlen - *done - run);
+			if (!OV_ISSET(ov, (pos + run) / OV_BSIZE) &&
+			    next != OV_BSIZE && pos + run + next != ov->ov_size)
+				break;
+			run += next;
+		}
+		n = pwrite(ov->ov_dfd, data + *done, run, ov->ov_dataoff + pos);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		/* after a short write, only the blocks written in full */
+		end = pos + n;
+		if ((size_t)n < run && end != ov->ov_size &&
+		    !OV_ISSET(ov, end / OV_BSIZE))
+			end -= end % OV_BSIZE;
+		if (end <= pos)
+			return EIO;
+		for (blk = pos / OV_BSIZE; blk * OV_BSIZE < end; ++blk) {
+			if (!OV_ISSET(ov, blk)) {
+				OV_SET(ov, blk);
+				ov->ov_mapdirty = true;
+			}
+		}
+		*done += end - pos;
+	}
+	return 0;
+}
+
+static void
+ov_exit(void)
+{
+
+	pthread_mutex_lock(&ov_mtx);
+	if (ov_image.ov_fd != -1 && ov_writemap(&ov_image) != 0)
+		warnx("overlay: cannot write the block map");
+	pthread_mutex_unlock(&ov_mtx);
+}
+
+/* copies len bytes at off of sfd to off + doff of dfd */
+static int
+ov_copy(int sfd, int dfd, uint64_t off, uint64_t doff, uint64_t len,
+    uint8_t *buf)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = fsu_image_pread(sfd, buf, MIN(len, OV_COPY), off);
+		if (n == -1)
+			return -1;
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		if (pwrite(dfd, buf, n, off - doff) != n)
+			return -1;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Writes the blocks of delta into image, or when out is not NULL,
+ * writes image with the blocks of delta to out.
+ */
+int
+fsu_overlay_merge(const char *image, const char *delta, const char *out)
+{
+	struct ov_image ov;
+	uint64_t blk, nblk, end, size;
+	uint8_t *buf;
+	int ifd, dfd, ofd, error;
+	bool indelta;
+
+	buf = malloc(OV_COPY);
+	if (buf == NULL) {
+		warn(NULL);
+		return -1;
+	}
+	ifd = dfd = ofd = -1;
+
+	ifd = open(image, out == NULL ? O_RDWR : O_RDONLY);
+	if (ifd == -1) {
+		warn("%s", image);
+		goto fail;
+	}
+	error = fsu_image_open(ifd);
+	if (error != 0) {
+		errno = error;
+		warn("%s", image);
+		goto fail;
+	}
+	if (fsu_image_fd(ifd) && out == NULL) {
+		warnx("%s: not a raw image, merge it into a new one with -o",
+		    image);
+		goto fail;
+	}
+	if (fsu_image_size(ifd, &size) == -1) {
+		warn("%s", image);
+		goto fail;
+	}
+	dfd = open(delta, O_RDONLY);
+	if (dfd == -1) {
+		warn("%s", delta);
+		goto fail;
+	}
+	error = ov_load(&ov, dfd, size, false);
+	if (error != 0) {
+		if (error != EINVAL) {
+			errno = error;
+			warn("%s", delta);
+		}
+		goto fail;
+	}
+	ov.ov_fd = ifd;
+
+	if (out != NULL) {
+		ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (ofd == -1) {
+			warn("%s", out);
+			goto fail2;
+		}
+	} else
+		ofd = ifd;
+
+	nblk = howmany(ov.ov_size, OV_BSIZE);
+	for (blk = 0; blk < nblk; blk = end) {
+		indelta = OV_ISSET(&ov, blk) != 0;
+		for (end = blk + 1; end < nblk &&
+		    (OV_ISSET(&ov, end) != 0) == indelta; ++end)
+			continue;
+		if (!indelta && ofd == ifd)
+			continue;
+		if (ov_copy(indelta ? dfd : ifd, ofd,
+		    (indelta ? ov.ov_dataoff : 0) + blk * OV_BSIZE,
+		    indelta ? ov.ov_dataoff : 0,
+		    MIN(end * OV_BSIZE, ov.ov_size) - blk * OV_BSIZE,
+		    buf) == -1) {
+			warn("%s", out != NULL ? out : image);
+			goto fail2;
+		}
+	}
+
+	if (fsync(ofd) == -1) {
+		warn("%s", out != NULL ? out : image);
+		goto fail2;
+	}
+	if (ofd != ifd)
+		close(ofd);
+	free(ov.ov_map);
+	close(dfd);
+	fsu_image_close(ifd);
+	close(ifd);
+	free(buf);
+	return 0;
+
+fail2:
+	free(ov.ov_map);
+	if (ofd != -1 && ofd != ifd)
+		close(ofd);
+fail:
+	if (dfd != -1)
+		close(dfd);
+	if (ifd != -1) {
+		fsu_image_close(ifd);
+		close(ifd);
+	}
+	free(buf);
+	return -1;
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Locates a partition of a whole-disk image, so that it can be mounted
+ * through an etfs window on the image instead of being copied out.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsu_bio.h"
+#include "fsu_part.h"
+
+#define MBR_SECSIZE	512
+#define MBR_MAGIC_OFF	510
+#define MBR_PART_OFF	446
+#define MBR_NPART	4
+#define MBR_EBR_MAX	128		/* logical partitions followed */
+
+#define MBR_TYPE_GPT	0xee
+#define MBR_IS_EXT(t)	((t) == 0x05 || (t) == 0x0f || (t) == 0x85)
+
+#define GPT_SIG		"EFI PART"
+#define GPT_HDR_MIN	92
+#define GPT_ENT_MIN	128
+#define GPT_NENT_MAX	1024
+
+static uint32_t	le32(const uint8_t *);
+static uint64_t	le64(const uint8_t *);
+static uint32_t	crc32(const uint8_t *, size_t);
+static int	readat(int, void *, size_t, off_t);
+static int	part_mbr(int, const uint8_t *, int, off_t *, off_t *);
+static int	part_gpt(int, int, off_t *, off_t *);
+
+static uint32_t
+le32(const uint8_t *p)
+{
+
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+le64(const uint8_t *p)
+{
+
+	return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static uint32_t
+crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc;
+	int i;
+
+	crc = 0xffffffff;
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (i = 0; i < 8; ++i)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static int
+readat(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t nread;
+
+	nread = fsu_image_pread(fd, buf, len, off);
+	if (nread == -1)
+		return -1;
+	if ((size_t)nread != len) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns the partition number at the end of path, "image@pN", and the
+ * path without it in buf, or 0 if there is no such suffix.
+ */
+int
+fsu_part_split(const char *path, char *buf, size_t len)
+{
+	const char *at, *p;
+	long partno;
+	char *ep;
+
+	at = strrchr(path, '@');
+	if (at == NULL || at[1] != 'p' || at[2] < '1' || at[2] > '9')
+		return 0;
+	for (p = at + 2; *p != '\0'; ++p)
+		if (*p < '0' || *p > '9')
+			return 0;
+
+	errno = 0;
+	partno = strtol(at + 2, &ep, 10);
+	if (errno != 0 || partno > GPT_NENT_MAX)
+		return 0;
+	if ((size_t)(at - path) >= len)
+		return 0;
+
+	memcpy(buf, path, at - path);
+	buf[at - path] = '\0';
+	return partno;
+}
+
+/*
+ * Finds partition partno of the image at path and returns its offset
+ * and size in bytes.
+ */
+int
+fsu_part_find(const char *path, int partno, off_t *off, off_t *size)
+{
+	uint8_t mbr[MBR_SECSIZE];
+	uint64_t isize;
+	int fd, i, rv;
+	bool gpt;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		warn("%s", path);
+		return -1;
+	}
+	/* the partitions of a qcow2 or zstd image are those it holds */
+	rv = fsu_image_open(fd);
+	if (rv != 0) {
+		errno = rv;
+		warn("%s", path);
+		close(fd);
+		return -1;
+	}
+	if (fsu_image_size(fd, &isize) == -1 ||
+	    readat(fd, mbr, sizeof(mbr), 0) == -1) {
+		warn("%s", path);
+		fsu_image_close(fd);
+		close(fd);
+		return -1;
+	}
+	if (mbr[MBR_MAGIC_OFF] != 0x55 || mbr[MBR_MAGIC_OFF + 1] != 0xaa) {
+		warnx("%s: no partition table", path);
+		fsu_image_close(fd);
+		close(fd);
+		return -1;
+	}
+
+	gpt = false;
+	for (i = 0; i < MBR_NPART; ++i)
+		if (mbr[MBR_PART_OFF + 16 * i + 4] == MBR_TYPE_GPT)
+			gpt = true;
+
+	rv = gpt ? part_gpt(fd, partno, off, size) :
+	    part_mbr(fd, mbr, partno, off, size);
+	fsu_image_close(fd);
+	close(fd);
+
+	if (rv == -1) {
+		warnx("%s: no partition %d", path, partno);
+		return -1;
+	}
+	if ((uint64_t)(*off + *size) > isize) {
+		warnx("%s: partition %d extends past the end of the image",
+		    path, partno);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+part_mbr(int fd, const uint8_t *mbr, int partno, off_t *off, off_t *size)
+{
+	uint8_t ebr[MBR_SECSIZE];
+	const uint8_t *pe;
+	uint64_t ext, cur;
+	int i, n;
+
+	ext = 0;
+	for (i = 0; i < MBR_NPART; ++i) {
+		pe = mbr + MBR_PART_OFF + 16 * i;
+		if (MBR_IS_EXT(pe[4]) && ext == 0)
+			ext = le32(pe + 8);
+		if (i + 1 != partno)
+			continue;
+		if (pe[4] == 0 || MBR_IS_EXT(pe[4]) || le32(pe + 12) == 0)
+			return -1;
+		*off = (off_t)le32(pe + 8) * MBR_SECSIZE;
+		*size = (off_t)le32(pe + 12) * MBR_SECSIZE;
+		return 0;
+	}
+
+	/*
+	 * Logical partitions: each extended boot record describes one of
+	 * them relative to itself and links to the next relative to the
+	 * start of the extended partition.
+	 */
+	if (ext == 0)
+		return -1;
+	cur = ext;
+	for (n = MBR_NPART + 1; n < MBR_NPART + 1 + MBR_EBR_MAX; ++n) {
+		if (readat(fd, ebr, sizeof(ebr), (off_t)cur * MBR_SECSIZE) ==
+		    -1 || ebr[MBR_MAGIC_OFF] != 0x55 ||
+		    ebr[MBR_MAGIC_OFF + 1] != 0xaa)
+			return -1;
+		pe = ebr + MBR_PART_OFF;
+		if (n == partno) {
+			if (pe[4] == 0 || le32(pe + 12) == 0)
+				return -1;
+			*off = (off_t)(cur + le32(pe + 8)) * MBR_SECSIZE;
+			*size = (off_t)le32(pe + 12) * MBR_SECSIZE;
+			return 0;
+		}
+		pe += 16;
+		if (!MBR_IS_EXT(pe[4]) || le32(pe + 8) == 0)
+			return -1;
+		cur = ext + le32(pe + 8);
+	}
+	return -1;
+}
+
+static int
+part_gpt(int fd, int partno, off_t *off, off_t *size)
+{
+	static const uint8_t unused[16];
+	static const int secsizes[] = { 512, 4096 };
+	uint8_t hdr[512], *ent;
+	uint32_t hsize, nent, entsize, crc;
+	uint64_t first, last;
+	size_t i;
+	int secsize;
+
+	/* the header is in the second sector, whatever its size */
+	secsize = 0;
+	for (i = 0; i < sizeof(secsizes) / sizeof(secsizes[0]); ++i) {
+		if (readat(fd, hdr, sizeof(hdr), secsizes[i]) == -1)
+			continue;
+		if (memcmp(hdr, GPT_SIG, 8) != 0)
+			continue;
+		hsize = le32(hdr + 12);
+		if (hsize < GPT_HDR_MIN || hsize > sizeof(hdr))
+			continue;
+		crc = le32(hdr + 16);
+		memset(hdr + 16, 0, 4);
+		if (crc32(hdr, hsize) != crc)
+			continue;
+		secsize = secsizes[i];
+		break;
+	}
+	if (secsize == 0)
+		return -1;
+
+	nent = le32(hdr + 80);
+	entsize = le32(hdr + 84);
+	if (partno > (int)nent || nent > GPT_NENT_MAX ||
+	    entsize < GPT_ENT_MIN || entsize % 8 != 0)
+		return -1;
+
+	ent = malloc((size_t)nent * entsize);
+	if (ent == NULL)
+		return -1;
+	if (readat(fd, ent, (size_t)nent * entsize,
+	    (off_t)le64(hdr + 72) * secsize) == -1 ||
+	    crc32(ent, (size_t)nent * entsize) != le32(hdr + 88)) {
+		free(ent);
+		return -1;
+	}
+
+	i = (size_t)(partno - 1) * entsize;
+	first = le64(ent + i + 32);
+	last = le64(ent + i + 40);
+	if (memcmp(ent + i, unused, sizeof(unused)) == 0 || last < first) {
+		free(ent);
+		return -1;
+	}
+	free(ent);
+
+	*off = (off_t)first * secsize;
+	*size = (off_t)(last - first + 1) * secsize;
+	return 0;
+}
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Access profile of the image, enabled with -o profile=<file>.
+ *
+ * When the profile does not exist yet, the blocks of the image read by
+ * the rump kernel are recorded, in the order they are first read and
+ * with the number of times they are read, and written to the profile
+ * when the image is closed.  It is a text file:
+ *	fsu-profile 1 block-size image-size
+ *	block count
+ *	...
+ *
+ * When it exists and was made for an image of the same size, it is
+ * replayed instead: a thread brings the blocks in, in the same order,
+ * while the program starts.  The host is asked to read them ahead with
+ * posix_fadvise(), or they are read into the block cache, or into the
+ * cache of the image format, when there is one.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#define PF_MAGIC	"fsu-profile"
+#define PF_VERSION	1
+#define PF_BSIZE	(64 * 1024)
+#define PF_RUN		(1024 * 1024)	/* largest read ahead at once */
+#define PF_HASHMIN	1024
+
+typedef int (*pf_io_fn)(int, int, void *, size_t, int64_t, size_t *);
+
+struct pf_ent {
+	uint64_t	pe_blk;
+	uint32_t	pe_count;
+};
+
+struct pf_profile {
+	int		pf_fd;		/* image, -1 when free */
+	char		*pf_path;
+	uint64_t	pf_size;	/* of the image */
+	bool		pf_record;	/* or replay */
+	bool		pf_full;	/* out of memory, no more blocks */
+	struct pf_ent	*pf_ents;
+	size_t		pf_nents;
+	size_t		pf_maxents;
+	uint32_t	*pf_hash;	/* index + 1 in pf_ents, 0 if free */
+	size_t		pf_hashsize;
+	pf_io_fn	pf_io;		/* NULL: posix_fadvise() */
+	pthread_t	pf_thread;
+	bool		pf_running;
+	bool		pf_stop;
+};
+
+static pthread_mutex_t pf_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct pf_profile pf_profile = { .pf_fd = -1 };
+static char *pf_wanted;			/* for the next image opened */
+
+static size_t	pf_slot(struct pf_profile *, uint64_t);
+static int	pf_grow(struct pf_profile *);
+static void	pf_touch(struct pf_profile *, uint64_t);
+static int	pf_load(struct pf_profile *, FILE *);
+static void	pf_write(struct pf_profile *);
+static void	*pf_replay(void *);
+static void	pf_free(struct pf_profile *);
+static void	pf_exit(void);
+
+/* slot of blk in the hash table, or the free one it would go to */
+static size_t
+pf_slot(struct pf_profile *pf, uint64_t blk)
+{
+	size_t i, mask;
+
+	mask = pf->pf_hashsize - 1;
+	i = (blk * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+	while (pf->pf_hash[i] != 0 &&
+	    pf->pf_ents[pf->pf_hash[i] - 1].pe_blk != blk)
+		i = (i + 1) & mask;
+	return i;
+}
+
+/* makes room for one more block, the hash table kept half empty */
+static int
+pf_grow(struct pf_profile *pf)
+{
+	struct pf_ent *ents;
+	uint32_t *hash, *ohash;
+	size_t i, size, osize;
+
+	if (pf->pf_nents == pf->pf_maxents) {
+		size = MAX(pf->pf_maxents * 2, PF_HASHMIN);
+		if (size > UINT32_MAX - 1)
+			return -1;
+		ents = realloc(pf->pf_ents, size * sizeof(*ents));
+		if (ents == NULL)
+			return -1;
+		pf->pf_ents = ents;
+		pf->pf_maxents = size;
+	}
+	if ((pf->pf_nents + 1) * 2 <= pf->pf_hashsize)
+		return 0;
+
+	size = MAX(pf->pf_hashsize * 2, PF_HASHMIN);
+	hash = calloc(size, sizeof(*hash));
+	if (hash == NULL)
+		return -1;
+	ohash = pf->pf_hash;
+	osize = pf->pf_hashsize;
+	pf->pf_hash = hash;
+	pf->pf_hashsize = size;
+	for (i = 0; i < osize; ++i)
+		if (ohash[i] != 0)
+			hash[pf_slot(pf,
+			    pf->pf_ents[ohash[i] - 1].pe_blk)] = ohash[i];
+	free(ohash);
+	return 0;
+}
+
+static void
+pf_touch(struct pf_profile *pf, uint64_t blk)
+{
+	size_t i;
+
+	if (pf->pf_hashsize != 0) {
+		i = pf_slot(pf, blk);
+		if (pf->pf_hash[i] != 0) {
+			if (pf->pf_ents[pf->pf_hash[i] - 1].pe_count <
+			    UINT32_MAX)
+				++pf->pf_ents[pf->pf_hash[i] - 1].pe_count;
+			return;
+		}
+	}
+	if (pf->pf_full)
+		return;
+	if (pf_grow(pf) == -1) {
+		warnx("%s: out of memory, the profile is incomplete",
+		    pf->pf_path);
+		pf->pf_full = true;
+		return;
+	}
+
+	pf->pf_ents[pf->pf_nents].pe_blk = blk;
+	pf->pf_ents[pf->pf_nents].pe_count = 1;
+	pf->pf_hash[pf_slot(pf, blk)] = ++pf->pf_nents;
+}
+
+/*
+ * Reads the blocks of the profile on fp.  Returns -1 if it is not one
+ * for this image.
+ */
+static int
+pf_load(struct pf_profile *pf, FILE *fp)
+{
+	char line[128], magic[16];
+	uintmax_t blk, size;
+	unsigned long count;
+	unsigned version, bsize;
+
+	if (fgets(line, sizeof(line), fp) == NULL ||
+	    sscanf(line, "%15s %u %u %ju", magic, &version, &bsize,
+	    &size) != 4 || strcmp(magic, PF_MAGIC) != 0 ||
+	    version != PF_VERSION || bsize != PF_BSIZE ||
+	    size != pf->pf_size)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%ju %lu", &blk, &count) != 2 ||
+		    blk >= howmany(pf->pf_size, PF_BSIZE))
+			return -1;
+		if (pf_grow(pf) == -1)
+			break;
+		pf->pf_ents[pf->pf_nents].pe_blk = blk;
+		pf->pf_ents[pf->pf_nents++].pe_count = count;
+	}
+	return 0;
+}
+
+/* replaces the profile in one go */
+static void
+pf_write(struct pf_profile *pf)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+	size_t i;
+	int fd, rv;
+
+	rv = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", pf->pf_path);
+	if (rv < 0 || (size_t)rv >= sizeof(tmp) ||
+	    (fd = mkstemp(tmp)) == -1) {
+		warnx("%s: cannot write the profile", pf->pf_path);
+		return;
+	}
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		warn("%s", pf->pf_path);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	fprintf(fp, PF_MAGIC " %u %u %ju\n", PF_VERSION, PF_BSIZE,
+	    (uintmax_t)pf->pf_size);
+	for (i = 0; i < pf->pf_nents; ++i)
+		fprintf(fp, "%ju %lu\n", (uintmax_t)pf->pf_ents[i].pe_blk,
+		    (unsigned long)pf->pf_ents[i].pe_count);
+	if (fclose(fp) != 0 || rename(tmp, pf->pf_path) == -1) {
+		warn("%s", pf->pf_path);
+		unlink(tmp);
+	}
+}
+
+/* runs of blocks following each other are brought in together */
+static void *
+pf_replay(void *arg)
+{
+	struct pf_profile *pf;
+	uint64_t off, len;
+	uint8_t *buf;
+	size_t i, j, done;
+	bool stop;
+
+	pf = arg;
+	buf = NULL;
+	if (pf->pf_io != NULL && (buf = malloc(PF_RUN)) == NULL)
+		return NULL;
+
+	for (i = 0; i < pf->pf_nents; i = j) {
+		for (j = i + 1; j < pf->pf_nents &&
+		    pf->pf_ents[j].pe_blk == pf->pf_ents[i].pe_blk + (j - i) &&
+		    (j - i) * PF_BSIZE < PF_RUN; ++j)
+			continue;
+
+		pthread_mutex_lock(&pf_mtx);
+		stop = pf->pf_stop;
+		pthread_mutex_unlock(&pf_mtx);
+		if (stop)
+			break;
+
+		off = pf->pf_ents[i].pe_blk * PF_BSIZE;
+		len = MIN((j - i) * PF_BSIZE, pf->pf_size - off);
+		if (pf->pf_io != NULL)
+			pf->pf_io(pf->pf_fd, RUMPUSER_BIO_READ, buf, len, off,
+			    &done);
+		else
+			posix_fadvise(pf->pf_fd, off, len,
+			    POSIX_FADV_WILLNEED);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void
+pf_free(struct pf_profile *pf)
+{
+
+	free(pf->pf_path);
+	free(pf->pf_ents);
+	free(pf->pf_hash);
+	memset(pf, 0, sizeof(*pf));
+	pf->pf_fd = -1;
+}
+
+static void
+pf_exit(void)
+{
+
+	fsu_prefetch_close(pf_profile.pf_fd);
+}
+
+/*
+ * Have the next image opened for block I/O record or replay the
+ * profile at path.
+ */
+void
+fsu_prefetch_enable(const char *path)
+{
+
+#ifdef NO_COMPONENT_DLOPEN
+	warnx("profiles are not available with a static rump kernel");
+#else
+	free(pf_wanted);
+	pf_wanted = strdup(path);
+	if (pf_wanted == NULL)
+		warn(NULL);
+#endif
+}
+
+/*
+ * Starts recording or replaying the profile for the image just opened
+ * on fd, reading it with io when not NULL.  A profile that cannot be
+ * used costs a warning only.
+ */
+void
+fsu_prefetch_open(int fd, pf_io_fn io)
+{
+	struct pf_profile *pf;
+	FILE *fp;
+	char *path;
+	int error;
+
+	if (pf_wanted == NULL)
+		return;
+	path = pf_wanted;
+	pf_wanted = NULL;
+
+	pf = &pf_profile;
+	if (pf->pf_fd != -1) {
+		warnx("%s: only one image can have a profile", path);
+		free(path);
+		return;
+	}
+	pf->pf_path = path;
+	if (fsu_image_size(fd, &pf->pf_size) == -1) {
+		warn("%s", path);
+		pf_free(pf);
+		return;
+	}
+
+	fp = fopen(path, "r");
+	if (fp == NULL && errno != ENOENT) {
+		warn("%s", path);
+		pf_free(pf);
+		return;
+	}
+	if (fp != NULL && pf_load(pf, fp) == -1) {
+		warnx("%s: not a profile of this image, recorded again",
+		    path);
+		pf->pf_nents = 0;
+		fclose(fp);
+		fp = NULL;
+	}
+	pf->pf_fd = fd;
+	atexit(pf_exit);
+
+	if (fp == NULL) {
+		pf->pf_record = true;
+		return;
+	}
+	fclose(fp);
+
+	/* direct I/O keeps the blocks out of the page cache */
+	if (io == NULL && fsu_direct_fd(fd)) {
+		warnx("%s: not replayed with direct I/O", path);
+		return;
+	}
+	pf->pf_io = io;
+	error = pthread_create(&pf->pf_thread, NULL, pf_replay, pf);
+	if (error != 0) {
+		errno = error;
+		warn("%s", path);
+		return;
+	}
+	pf->pf_running = true;
+}
+
+void
+fsu_prefetch_record(int fd, int64_t off, size_t len)
+{
+	struct pf_profile *pf;
+	uint64_t blk;
+
+	pf = &pf_profile;
+	if (fd == -1 || pf->pf_fd != fd || !pf->pf_record || len == 0 ||
+	    off < 0)
+		return;
+
+	pthread_mutex_lock(&pf_mtx);
+	for (blk = off / PF_BSIZE; blk <= (off + len - 1) / PF_BSIZE; ++blk)
+		pf_touch(pf, blk);
+	pthread_mutex_unlock(&pf_mtx);
+}
+
+/*
+ * Stops the replay, or writes the profile recorded, when the image on
+ * fd is closed.
+ */
+void
+fsu_prefetch_close(int fd)
+{
+	struct pf_profile *pf;
+
+	pf = &pf_profile;
+	if (fd == -1 || pf->pf_fd != fd)
+		return;
+
+	if (pf->pf_running) {
+		pthread_mutex_lock(&pf_mtx);
+		pf->pf_stop = true;
+		pthread_mutex_unlock(&pf_mtx);
+		pthread_join(pf->pf_thread, NULL);
+	}
+	pthread_mutex_lock(&pf_mtx);
+	if (pf->pf_record)
+		pf_write(pf);
+	pf_free(pf);
+	pthread_mutex_unlock(&pf_mtx);
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File system type detection by superblock signature.
+ *
+ * Instead of trying to mount the image with every file system in turn,
+ * read the first blocks of the image once from the host and look for
+ * the magic numbers of the supported disk file systems.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#ifdef __NetBSD__
+#include <sys/mount.h>
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef __NetBSD__
+#include "nb_fs.h"
+#endif
+
+#include "fsu_bio.h"
+#include "fsu_probe.h"
+
+/* enough to cover the ufs2 superblock at 64k and the udf vrs */
+#define PROBE_SIZE (128 * 1024)
+
+#define CD9660_VD_OFFSET	(16 * 2048)
+#define EXT2FS_SB_OFFSET	1024
+#define EXT2FS_MAGIC_OFFSET	56
+#define EXT2FS_MAGIC		0xef53
+#define FFS_MAGIC_OFFSET	1372
+#define FFS_UFS1_MAGIC		0x00011954
+#define FFS_UFS2_MAGIC		0x19540119
+#define LFS_SB_OFFSET		8192
+#define LFS_MAGIC		0x00070162
+#define LFS64_MAGIC		0x19620701
+#define EFS_SB_OFFSET		512
+#define EFS_MAGIC_OFFSET	28
+#define EFS_MAGIC		0x00072959
+#define EFS_NEWMAGIC		0x0007295a
+#define SYSVBFS_MAGIC		0x1badface
+#define V7FS_SB_OFFSET		512
+#define V7FS_MAX_FREEBLOCK	50
+#define V7FS_MAX_FREEINODE	100
+
+static const off_t ffs_sblocks[] = { 65536, 8192, 0, -1 };
+
+static uint16_t
+le16(const uint8_t *p)
+{
+
+	return p[0] | (p[1] << 8);
+}
+
+static uint16_t
+be16(const uint8_t *p)
+{
+
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t
+be32(const uint8_t *p)
+{
+
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* magic numbers may be stored in either byte order */
+static int
+match32(const uint8_t *p, uint32_t magic)
+{
+
+	return le32(p) == magic || be32(p) == magic;
+}
+
+static int
+probe_cd9660(const uint8_t *buf, size_t len)
+{
+
+	if (len < CD9660_VD_OFFSET + 6)
+		return 0;
+	return memcmp(buf + CD9660_VD_OFFSET + 1, "CD001", 5) == 0;
+}
+
+static int
+probe_udf(const uint8_t *buf, size_t len)
+{
+	size_t off;
+
+	/* volume recognition sequence, one descriptor per 2k sector */
+	for (off = CD9660_VD_OFFSET; off + 6 <= len &&
+	    off < CD9660_VD_OFFSET + 8 * 2048; off += 2048)
+		if (memcmp(buf + off + 1, "NSR02", 5) == 0 ||
+		    memcmp(buf + off + 1, "NSR03", 5) == 0)
+			return 1;
+	return 0;
+}
+
+static int
+probe_ext2fs(const uint8_t *buf, size_t len)
+{
+
+	if (len < EXT2FS_SB_OFFSET + EXT2FS_MAGIC_OFFSET + 2)
+		return 0;
+	return le16(buf + EXT2FS_SB_OFFSET + EXT2FS_MAGIC_OFFSET) ==
+	    EXT2FS_MAGIC;
+}
+
+static int
+probe_ffs(const uint8_t *buf, size_t len)
+{
+	const uint8_t *p;
+	int i;
+
+	for (i = 0; ffs_sblocks[i] != -1; ++i) {
+		if ((size_t)ffs_sblocks[i] + FFS_MAGIC_OFFSET + 4 > len)
+			continue;
+		p = buf + ffs_sblocks[i] + FFS_MAGIC_OFFSET;
+		if (match32(p, FFS_UFS1_MAGIC) || match32(p, FFS_UFS2_MAGIC))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+probe_lfs(const uint8_t *buf, size_t len)
+{
+	const uint8_t *p;
+
+	if (len < LFS_SB_OFFSET + 4)
+		return 0;
+	p = buf + LFS_SB_OFFSET;
+	return match32(p, LFS_MAGIC) || match32(p, LFS64_MAGIC);
+}
+
+static int
+probe_ntfs(const uint8_t *buf, size_t len)
+{
+
+	if (len < 512)
+		return 0;
+	return memcmp(buf + 3, "NTFS    ", 8) == 0;
+}
+
+static int
+probe_msdos(const uint8_t *buf, size_t len)
+{
+	uint16_t bps;
+
+	if (len < 512)
+		return 0;
+	if (buf[510] != 0x55 || buf[511] != 0xaa)
+		return 0;
+	if (buf[0] != 0xeb && buf[0] != 0xe9)
+		return 0;
+	/* bytes per sector is a power of two between 512 and 4096 */
+	bps = le16(buf + 11);
+	if (bps < 512 || bps > 4096 || (bps & (bps - 1)) != 0)
+		return 0;
+	/* sectors per cluster is a power of two as well */
+	if (buf[13] == 0 || (buf[13] & (buf[13] - 1)) != 0)
+		return 0;
+	/* number of FATs */
+	return buf[16] != 0;
+}
+
+static int
+probe_efs(const uint8_t *buf, size_t len)
+{
+	uint32_t magic;
+
+	if (len < EFS_SB_OFFSET + EFS_MAGIC_OFFSET + 4)
+		return 0;
+	magic = be32(buf + EFS_SB_OFFSET + EFS_MAGIC_OFFSET);
+	return magic == EFS_MAGIC || magic == EFS_NEWMAGIC;
+}
+
+static int
+probe_sysvbfs(const uint8_t *buf, size_t len)
+{
+
+	if (len < 4)
+		return 0;
+	return match32(buf, SYSVBFS_MAGIC);
+}
+
+/*
+ * v7fs has no magic number, so sanity check the superblock for each of
+ * the byte orders it supports.  This is the weakest test and is done last.
+ */
+static int
+probe_v7fs(const uint8_t *buf, size_t len, off_t isize)
+{
+	const uint8_t *p;
+	uint32_t volsize[3];
+	uint16_t dstart, nfree, ninode;
+	int i, be;
+
+	if (len < V7FS_SB_OFFSET + 212)
+		return 0;
+	p = buf + V7FS_SB_OFFSET;
+
+	/* pdp endian shares the 16-bit layout of little endian */
+	volsize[0] = le32(p + 2);
+	volsize[1] = be32(p + 2);
+	volsize[2] = (le16(p + 2) << 16) | le16(p + 4);
+	for (i = 0; i < 3; ++i) {
+		be = (i == 1);
+		dstart = be ? be16(p) : le16(p);
+		nfree = be ? be16(p + 6) : le16(p + 6);
+		ninode = be ? be16(p + 208) : le16(p + 208);
+
+		if (dstart < 2 || volsize[i] <= dstart)
+			continue;
+		if (isize > 0 && (off_t)volsize[i] * 512 > isize)
+			continue;
+		if (nfree > V7FS_MAX_FREEBLOCK || ninode > V7FS_MAX_FREEINODE)
+			continue;
+		return 1;
+	}
+	return 0;
+}
+
+const char *
+fsu_probe(const char *path, off_t off, off_t size)
+{
+	uint8_t *buf;
+	const char *rv;
+	ssize_t nread;
+	size_t len;
+	uint64_t isize;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	buf = malloc(PROBE_SIZE);
+	if (buf == NULL || fsu_image_open(fd) != 0) {
+		free(buf);
+		close(fd);
+		return NULL;
+	}
+
+	len = 0;
+	while (len < PROBE_SIZE) {
+		nread = fsu_image_pread(fd, buf + len, PROBE_SIZE - len,
+		    off + len);
+		if (nread <= 0)
+			break;
+		len += nread;
+	}
+	if (size != 0)
+		isize = size;
+	else if (fsu_image_size(fd, &isize) == -1 || isize == 0)
+		isize = lseek(fd, 0, SEEK_END);
+	fsu_image_close(fd);
+	close(fd);
+	if (size != 0 && (off_t)len > size)
+		len = size;
+
+	/*
+	 * order matters: a udf bridge disc also has an iso9660 descriptor
+	 * and is taken for cd9660, ntfs has a fat-like boot sector
+	 */
+	rv = NULL;
+	if (probe_cd9660(buf, len))
+		rv = MOUNT_CD9660;
+	else if (probe_udf(buf, len))
+		rv = MOUNT_UDF;
+	else if (probe_ntfs(buf, len))
+		rv = MOUNT_NTFS;
+	else if (probe_ext2fs(buf, len))
+		rv = MOUNT_EXT2FS;
+	else if (probe_ffs(buf, len))
+		rv = MOUNT_FFS;
+	else if (probe_lfs(buf, len))
+		rv = MOUNT_LFS;
+	else if (probe_efs(buf, len))
+		rv = MOUNT_EFS;
+	else if (probe_sysvbfs(buf, len))
+		rv = MOUNT_SYSVBFS;
+	else if (probe_msdos(buf, len))
+		rv = MOUNT_MSDOS;
+	else if (probe_v7fs(buf, len, isize))
+		rv = MOUNT_V7FS;
+
+	free(buf);
+	return rv;
+}
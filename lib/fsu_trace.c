@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Phase timing for fsu_mount() and fsu_unmount().
+ *
+ * FSU_TRACE=1 prints a table of the phases on stderr when the program
+ * exits.  Any other non-empty value is the name of a file to which a
+ * JSON object is appended for each phase as it ends, e.g.
+ *	{"pid":42,"phase":"mount","fs":"ffs","start":0.001,"time":0.003,"rv":0}
+ * Times are in seconds on the monotonic clock, starts are relative to
+ * the first traced phase.
+ */
+
+#include "fs-utils.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fsu_trace.h"
+
+#define TRACE_MAX	64		/* phases kept for the table */
+
+struct trace_s {
+	const char	*tr_phase;
+	const char	*tr_fs;
+	double		tr_start;
+	double		tr_time;
+	int		tr_rv;
+};
+
+static enum { TRACE_UNSET, TRACE_OFF, TRACE_TABLE, TRACE_JSON } trace_mode;
+static FILE *trace_fp;
+static struct timespec trace_epoch;
+static struct trace_s trace_tab[TRACE_MAX];
+static int trace_count;
+
+static bool	trace_init(void);
+static double	trace_diff(const struct timespec *, const struct timespec *);
+static void	trace_table(void);
+
+static bool
+trace_init(void)
+{
+	const char *env;
+
+	if (trace_mode != TRACE_UNSET)
+		return trace_mode != TRACE_OFF;
+
+	trace_mode = TRACE_OFF;
+	env = getenv("FSU_TRACE");
+	if (env == NULL || env[0] == '\0')
+		return false;
+
+	if (strcmp(env, "1") == 0) {
+		if (atexit(trace_table) != 0)
+			return false;
+		trace_mode = TRACE_TABLE;
+	} else {
+		trace_fp = fopen(env, "a");
+		if (trace_fp == NULL) {
+			warn("FSU_TRACE: %s", env);
+			return false;
+		}
+		trace_mode = TRACE_JSON;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+	return true;
+}
+
+static double
+trace_diff(const struct timespec *end, const struct timespec *start)
+{
+
+	return (end->tv_sec - start->tv_sec) +
+	    (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void
+fsu_trace_start(struct timespec *ts)
+{
+
+	if (trace_init())
+		clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+void
+fsu_trace_end(const struct timespec *ts, const char *phase, const char *fs,
+    int rv)
+{
+	struct timespec now;
+	struct trace_s *tr;
+
+	if (!trace_init())
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (trace_mode == TRACE_JSON) {
+		fprintf(trace_fp, "{\"pid\":%ld,\"phase\":\"%s\",",
+		    (long)getpid(), phase);
+		if (fs != NULL)
+			fprintf(trace_fp, "\"fs\":\"%s\",", fs);
+		fprintf(trace_fp, "\"start\":%.6f,\"time\":%.6f,\"rv\":%d}\n",
+		    trace_diff(ts, &trace_epoch), trace_diff(&now, ts), rv);
+		fflush(trace_fp);
+		return;
+	}
+
+	if (trace_count == TRACE_MAX)
+		return;
+	tr = &trace_tab[trace_count++];
+	tr->tr_phase = phase;
+	tr->tr_fs = fs;
+	tr->tr_start = trace_diff(ts, &trace_epoch);
+	tr->tr_time = trace_diff(&now, ts);
+	tr->tr_rv = rv;
+}
+
+static void
+trace_table(void)
+{
+	struct trace_s *tr;
+	double total;
+
+	fprintf(stderr, "%-16s %-10s %12s %12s %4s\n",
+	    "phase", "fs", "start (ms)", "time (ms)", "rv");
+	total = 0;
+	for (tr = trace_tab; tr < trace_tab + trace_count; ++tr) {
+		fprintf(stderr, "%-16s %-10s %12.3f %12.3f %4d\n",
+		    tr->tr_phase, tr->tr_fs != NULL ? tr->tr_fs : "-",
+		    tr->tr_start * 1e3, tr->tr_time * 1e3, tr->tr_rv);
+		total += tr->tr_time;
+	}
+	fprintf(stderr, "%-16s %-10s %12s %12.3f\n", "total", "", "",
+	    total * 1e3);
+}
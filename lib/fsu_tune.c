@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Sizing of the rump kernel, before rump_init().
+ *
+ * By default the rump kernel keeps 1024 vnodes, whatever the image,
+ * and takes as much host memory as it wants.  The memory limit is
+ * chosen here from the size of the image and the memory available on
+ * the host, the vnode cache from the memory limit and the share of the
+ * buffer cache from the file system type: file systems that go through
+ * their metadata blocks get more than those read through the page
+ * cache.  The memlimit=, nvnodes= and bufcache= mount options override
+ * the choice, and so do RUMP_MEMLIMIT and RUMP_NVNODES when set.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsu_tune.h"
+
+#define TUNE_MEM_MIN	(32ULL << 20)
+#define TUNE_MEM_MAX	(2ULL << 30)
+#define TUNE_MEM_IMG	16		/* image bytes per byte of memory */
+#define TUNE_VNODE_MEM	(16 * 1024)	/* memory per vnode */
+#define TUNE_VNODES_MIN	1024
+#define TUNE_VNODES_MAX	(256 * 1024)
+
+/* no image to size for */
+static const char *const tune_none[] = {
+	"kernfs", "nfs", "ptyfs", "smbfs", "tmpfs", NULL
+};
+
+/* metadata in the buffer cache */
+static const char *const tune_meta[] = {
+	"ext2fs", "ffs", "lfs", "msdos", "ntfs", "sysvbfs", "v7fs", NULL
+};
+
+/* data in the page cache */
+static const char *const tune_data[] = {
+	"cd9660", "efs", "hfs", "udf", NULL
+};
+
+static uint64_t	tune_host(void);
+static int	tune_in(const char *, const char *const *);
+
+/*
+ * Parses a memlimit=, nvnodes= or bufcache= mount option into ft,
+ * returns 1 if opt is one of them, 0 if not, and -1 if it is invalid.
+ */
+int
+fsu_tune_parse(const char *opt, struct fsu_tune_s *ft)
+{
+	static const char units[] = "kKmMgG";
+	const char *v, *p;
+	char *ep;
+	uintmax_t n;
+
+	if ((v = strchr(opt, '=')) == NULL)
+		return 0;
+	++v;
+	if (strncmp(opt, "memlimit=", 9) != 0 &&
+	    strncmp(opt, "nvnodes=", 8) != 0 &&
+	    strncmp(opt, "bufcache=", 9) != 0)
+		return 0;
+
+	errno = 0;
+	n = strtoumax(v, &ep, 10);
+	if (errno != 0 || ep == v || n == 0)
+		goto bad;
+
+	if (opt[0] == 'm') {
+		p = strchr(units, *ep);
+		if (*ep != '\0' && p != NULL) {
+			if (n > UINT64_MAX >> (10 * ((p - units) / 2 + 1)))
+				goto bad;
+			n <<= 10 * ((p - units) / 2 + 1);
+			++ep;
+		}
+		if (n < TUNE_MEM_MIN / 4)
+			goto bad;
+		ft->ft_memlimit = n;
+	} else if (opt[0] == 'n') {
+		if (n > UINT32_MAX)
+			goto bad;
+		ft->ft_nvnodes = n;
+	} else {
+		if (n > 90)
+			goto bad;
+		ft->ft_bufcache = n;
+	}
+	if (*ep != '\0')
+		goto bad;
+	return 1;
+
+bad:
+	warnx("%s: invalid size", opt);
+	return -1;
+}
+
+/*
+ * Fills in what ft leaves to choose for an image of imgsize bytes
+ * (0 if not known) and of type fstype (NULL if not known yet).
+ */
+void
+fsu_tune(struct fsu_tune_s *ft, uint64_t imgsize, const char *fstype)
+{
+	uint64_t mem, max;
+
+	if (fstype != NULL && tune_in(fstype, tune_none))
+		return;
+
+	if (ft->ft_memlimit == 0 && getenv("RUMP_MEMLIMIT") == NULL) {
+		max = tune_host() / 2;
+		if (max > TUNE_MEM_MAX)
+			max = TUNE_MEM_MAX;
+		mem = TUNE_MEM_MIN + imgsize / TUNE_MEM_IMG;
+		if (mem > max)
+			mem = max;
+		if (mem < TUNE_MEM_MIN)
+			mem = TUNE_MEM_MIN;
+		ft->ft_memlimit = mem & ~((1ULL << 20) - 1);
+	}
+
+	if (ft->ft_nvnodes == 0 && getenv("RUMP_NVNODES") == NULL) {
+		mem = ft->ft_memlimit != 0 ? ft->ft_memlimit : TUNE_MEM_MAX;
+		mem /= TUNE_VNODE_MEM;
+		if (mem < TUNE_VNODES_MIN)
+			mem = TUNE_VNODES_MIN;
+		if (mem > TUNE_VNODES_MAX)
+			mem = TUNE_VNODES_MAX;
+		ft->ft_nvnodes = mem;
+	}
+
+	if (ft->ft_bufcache == 0 && fstype != NULL) {
+		if (tune_in(fstype, tune_meta))
+			ft->ft_bufcache = 25;
+		else if (tune_in(fstype, tune_data))
+			ft->ft_bufcache = 10;
+	}
+}
+
+/*
+ * Hands the sizes to the rump kernel, to be called before rump_init().
+ */
+void
+fsu_tune_apply(const struct fsu_tune_s *ft, int verbose)
+{
+	char buf[32];
+	unsigned *bufcache;
+	const char *env;
+
+	if (ft->ft_memlimit != 0) {
+		snprintf(buf, sizeof(buf), "%" PRIu64, ft->ft_memlimit);
+		setenv("RUMP_MEMLIMIT", buf, 1);
+	}
+	if (ft->ft_nvnodes != 0) {
+		snprintf(buf, sizeof(buf), "%u", ft->ft_nvnodes);
+		setenv("RUMP_NVNODES", buf, 1);
+	}
+
+	/* there is no parameter for it, the kernel reads it in rump_init() */
+	bufcache = NULL;
+#ifndef NO_COMPONENT_DLOPEN
+	if (ft->ft_bufcache != 0) {
+		bufcache = dlsym(RTLD_DEFAULT, "rumpns_bufcache");
+		if (bufcache != NULL)
+			*bufcache = ft->ft_bufcache;
+	}
+#endif
+
+	if (!verbose)
+		return;
+	printf("rump kernel:");
+	if ((env = getenv("RUMP_MEMLIMIT")) != NULL)
+		printf(" memlimit %s%s,", env,
+		    ft->ft_memlimit != 0 ? "" : " (environment)");
+	else
+		printf(" memlimit none,");
+	if ((env = getenv("RUMP_NVNODES")) != NULL)
+		printf(" %s vnodes%s,", env,
+		    ft->ft_nvnodes != 0 ? "" : " (environment)");
+	else
+		printf(" default vnodes,");
+	if (bufcache != NULL)
+		printf(" bufcache %u%%\n", *bufcache);
+	else
+		printf(" default bufcache\n");
+}
+
+/*
+ * Memory the host can give, all of it if it does not tell.
+ */
+static uint64_t
+tune_host(void)
+{
+	long pages, pagesize;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+#ifdef _SC_AVPHYS_PAGES
+	pages = sysconf(_SC_AVPHYS_PAGES);
+#else
+	pages = sysconf(_SC_PHYS_PAGES) / 2;
+#endif
+	if (pages <= 0 || pagesize <= 0)
+		return UINT64_MAX;
+	return (uint64_t)pages * pagesize;
+}
+
+static int
+tune_in(const char *fstype, const char *const *list)
+{
+
+	for (; *list != NULL; ++list)
+		if (strcmp(fstype, *list) == 0)
+			return 1;
+	return 0;
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * io_uring backend for the image, enabled with FSU_URING=<queue depth>.
+ *
+ * librumpuser serves the block I/O of the rump kernel from a single
+ * host thread, one pread or pwrite at a time.  Here every request is
+ * queued to an io_uring as soon as the rump kernel issues it, up to
+ * the queue depth, and a completion thread hands the results back to
+ * the rump kernel as the host finishes them.  Short transfers are
+ * requeued for the remainder, synchronous writes are issued with
+ * RWF_DSYNC.  A request the ring has no room for goes to librumpuser,
+ * a remainder that cannot be requeued is finished by the completion
+ * thread with pread or pwrite.
+ *
+ * When io_uring is not supported by the headers or refused by the
+ * host, fsu_uring_init() fails and the requests go to librumpuser.
+ */
+
+#define _GNU_SOURCE		/* RWF_DSYNC */
+
+#include "fs-utils.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rump/rumpuser.h>
+
+#include "fsu_bio.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+#include <sys/mman.h>
+
+#include <linux/io_uring.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifndef RWF_DSYNC
+#define RWF_DSYNC	0x00000002
+#endif
+
+#define UR_DEPTH_MAX	4096
+
+struct ur_req {
+	struct ur_req	*ur_next;	/* free list */
+	struct iovec	ur_iov;		/* what is left to transfer */
+	int		ur_fd;
+	int		ur_op;
+	int64_t		ur_off;
+	size_t		ur_len;
+	size_t		ur_done;
+	rump_biodone_fn	ur_biodone;
+	void		*ur_arg;
+};
+
+static const struct rumpuser_hyperup *ur_hyp;
+static pthread_mutex_t ur_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ur_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t ur_thread;
+static bool ur_running;
+static int ur_ring;
+static struct ur_req *ur_reqs, *ur_free;
+
+static unsigned *ur_sqtail, *ur_sqmask, *ur_sqarray;
+static struct io_uring_sqe *ur_sqes;
+static unsigned *ur_cqhead, *ur_cqtail, *ur_cqmask;
+static struct io_uring_cqe *ur_cqes;
+
+static int	ur_enter(unsigned, unsigned, unsigned);
+static int	ur_queue(struct ur_req *);
+static int	ur_sync(struct ur_req *);
+static void	ur_complete(struct ur_req *, int);
+static void	*ur_reap(void *);
+
+static int
+ur_enter(unsigned submit, unsigned complete, unsigned flags)
+{
+
+	return syscall(__NR_io_uring_enter, ur_ring, submit, complete, flags,
+	    NULL, 0);
+}
+
+int
+fsu_uring_init(const struct rumpuser_hyperup *hyp)
+{
+	struct io_uring_params p;
+	const char *env;
+	char *ep, *sq, *cq;
+	unsigned long depth;
+	size_t sqsz, cqsz, sqesz, i;
+
+	env = getenv("FSU_URING");
+	if (env == NULL || env[0] == '\0')
+		return -1;
+
+	errno = 0;
+	depth = strtoul(env, &ep, 10);
+	if (errno != 0 || *ep != '\0' || depth == 0 || depth > UR_DEPTH_MAX) {
+		warnx("FSU_URING: %s: invalid queue depth", env);
+		return -1;
+	}
+
+	sq = cq = MAP_FAILED;
+	ur_sqes = MAP_FAILED;
+	sqesz = 0;
+	memset(&p, 0, sizeof(p));
+	ur_ring = syscall(__NR_io_uring_setup, (unsigned)depth, &p);
+	if (ur_ring == -1) {
+		warn("FSU_URING: io_uring_setup");
+		return -1;
+	}
+
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sqsz = cqsz = MAX(sqsz, cqsz);
+
+	sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    ur_ring, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else {
+		cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ur_ring, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+	}
+	sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur_sqes = mmap(NULL, sqesz,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur_ring,
+	    IORING_OFF_SQES);
+	if (ur_sqes == MAP_FAILED)
+		goto fail;
+
+	ur_sqtail = (unsigned *)(sq + p.sq_off.tail);
+	ur_sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur_sqarray = (unsigned *)(sq + p.sq_off.array);
+	ur_cqhead = (unsigned *)(cq + p.cq_off.head);
+	ur_cqtail = (unsigned *)(cq + p.cq_off.tail);
+	ur_cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/*
+	 * No more requests in flight than the submission queue holds,
+	 * the completion queue is twice as large and cannot overflow.
+	 */
+	depth = MIN(depth, p.sq_entries);
+	ur_reqs = calloc(depth, sizeof(*ur_reqs));
+	if (ur_reqs == NULL)
+		goto fail;
+	for (i = 0; i < depth; ++i) {
+		ur_reqs[i].ur_next = ur_free;
+		ur_free = &ur_reqs[i];
+	}
+
+	ur_hyp = hyp;
+	return 0;
+
+fail:
+	warn("FSU_URING");
+	if (ur_sqes != MAP_FAILED)
+		munmap(ur_sqes, sqesz);
+	if (cq != MAP_FAILED && cq != sq)
+		munmap(cq, cqsz);
+	if (sq != MAP_FAILED)
+		munmap(sq, sqsz);
+	close(ur_ring);
+	return -1;
+}
+
+int
+fsu_uring_submit(int fd, int op, void *data, size_t dlen, int64_t off,
+    rump_biodone_fn biodone, void *arg)
+{
+	struct ur_req *req;
+	int error;
+
+	pthread_mutex_lock(&ur_mtx);
+	if (!ur_running) {
+		error = pthread_create(&ur_thread, NULL, ur_reap, NULL);
+		if (error != 0) {
+			pthread_mutex_unlock(&ur_mtx);
+			return error;
+		}
+		ur_running = true;
+	}
+
+	while (ur_free == NULL)
+		pthread_cond_wait(&ur_cv, &ur_mtx);
+	req = ur_free;
+	ur_free = req->ur_next;
+
+	req->ur_iov.iov_base = data;
+	req->ur_iov.iov_len = dlen;
+	req->ur_fd = fd;
+	req->ur_op = op;
+	req->ur_off = off;
+	req->ur_len = dlen;
+	req->ur_done = 0;
+	req->ur_biodone = biodone;
+	req->ur_arg = arg;
+
+	error = ur_queue(req);
+	if (error != 0) {
+		req->ur_next = ur_free;
+		ur_free = req;
+	}
+	pthread_mutex_unlock(&ur_mtx);
+
+	return error;
+}
+
+/*
+ * Hand one request to the kernel, called with ur_mtx held.  The
+ * submission queue is always empty when we get here, so a request the
+ * kernel refuses is taken back out of it.  A full ring is not waited
+ * for under the lock, that would stall the completion thread which
+ * drains it; EAGAIN is returned and the caller goes elsewhere.
+ */
+static int
+ur_queue(struct ur_req *req)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	int rv;
+
+	tail = *ur_sqtail;
+	idx = tail & *ur_sqmask;
+	sqe = &ur_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	if (req->ur_op & RUMPUSER_BIO_WRITE) {
+		sqe->opcode = IORING_OP_WRITEV;
+		if (req->ur_op & RUMPUSER_BIO_SYNC)
+			sqe->rw_flags = RWF_DSYNC;
+	} else
+		sqe->opcode = IORING_OP_READV;
+	sqe->fd = req->ur_fd;
+	sqe->addr = (uintptr_t)&req->ur_iov;
+	sqe->len = 1;
+	sqe->off = req->ur_off + req->ur_done;
+	sqe->user_data = (uintptr_t)req;
+	ur_sqarray[idx] = idx;
+	__atomic_store_n(ur_sqtail, tail + 1, __ATOMIC_RELEASE);
+
+	while ((rv = ur_enter(1, 0, 0)) == -1 && errno == EINTR)
+		continue;
+	if (rv == 1)
+		return 0;
+
+	__atomic_store_n(ur_sqtail, tail, __ATOMIC_RELEASE);
+	if (rv == 0 || errno == EBUSY)
+		return EAGAIN;
+	return errno;
+}
+
+/*
+ * Finish what is left of a request on this thread, for when the ring
+ * has no room to requeue it.
+ */
+static int
+ur_sync(struct ur_req *req)
+{
+	ssize_t n;
+	int64_t off;
+
+	while (req->ur_done < req->ur_len) {
+		off = req->ur_off + req->ur_done;
+		if (req->ur_op & RUMPUSER_BIO_WRITE)
+			n = pwrite(req->ur_fd, req->ur_iov.iov_base,
+			    req->ur_iov.iov_len, off);
+		else
+			n = pread(req->ur_fd, req->ur_iov.iov_base,
+			    req->ur_iov.iov_len, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			break;
+		req->ur_done += n;
+		req->ur_iov.iov_base = (uint8_t *)req->ur_iov.iov_base + n;
+		req->ur_iov.iov_len -= n;
+	}
+
+	if ((req->ur_op & (RUMPUSER_BIO_WRITE | RUMPUSER_BIO_SYNC)) ==
+	    (RUMPUSER_BIO_WRITE | RUMPUSER_BIO_SYNC) &&
+	    fdatasync(req->ur_fd) == -1)
+		return errno;
+	return 0;
+}
+
+static void
+ur_complete(struct ur_req *req, int res)
+{
+	rump_biodone_fn biodone;
+	void *arg;
+	size_t done;
+	int error;
+
+	error = 0;
+	if (res < 0)
+		error = -res;
+	else if (res > 0) {
+		req->ur_done += res;
+		if (req->ur_done < req->ur_len) {
+			req->ur_iov.iov_base = (uint8_t *)req->ur_iov.iov_base
+			    + res;
+			req->ur_iov.iov_len -= res;
+			pthread_mutex_lock(&ur_mtx);
+			error = ur_queue(req);
+			pthread_mutex_unlock(&ur_mtx);
+			if (error == 0)
+				return;
+			if (error == EAGAIN)
+				error = ur_sync(req);
+		}
+	}
+
+	biodone = req->ur_biodone;
+	arg = req->ur_arg;
+	done = req->ur_done;
+
+	pthread_mutex_lock(&ur_mtx);
+	req->ur_next = ur_free;
+	ur_free = req;
+	pthread_cond_signal(&ur_cv);
+	pthread_mutex_unlock(&ur_mtx);
+
+	ur_hyp->hyp_schedule();
+	biodone(arg, done, error);
+	ur_hyp->hyp_unschedule();
+}
+
+/* like the bio thread of librumpuser, with an lwp of its own */
+static void *
+ur_reap(void *arg)
+{
+	struct io_uring_cqe *cqe;
+	struct ur_req *req;
+	unsigned head, tail;
+	int res;
+
+	ur_hyp->hyp_schedule();
+	ur_hyp->hyp_lwproc_newlwp(0);
+	ur_hyp->hyp_unschedule();
+
+	for (;;) {
+		if (ur_enter(0, 1, IORING_ENTER_GETEVENTS) == -1 &&
+		    errno != EINTR)
+			err(EXIT_FAILURE, "io_uring_enter");
+
+		head = *ur_cqhead;
+		tail = __atomic_load_n(ur_cqtail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			cqe = &ur_cqes[head & *ur_cqmask];
+			req = (struct ur_req *)(uintptr_t)cqe->user_data;
+			res = cqe->res;
+			__atomic_store_n(ur_cqhead, ++head, __ATOMIC_RELEASE);
+			ur_complete(req, res);
+		}
+	}
+
+	return NULL;
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+int
+fsu_uring_init(const struct rumpuser_hyperup *hyp)
+{
+
+	if (getenv("FSU_URING") != NULL)
+		warnx("FSU_URING: io_uring not supported");
+	return -1;
+}
+
+int
+fsu_uring_submit(int fd, int op, void *data, size_t dlen, int64_t off,
+    rump_biodone_fn biodone, void *arg)
+{
+
+	return EOPNOTSUPP;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
@@ -32,6 +32,8 @@
 #include <stdint.h>
 
 #include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
 
 #define user_from_uid(a, b) (NULL)
 #define group_from_gid(a, b) (NULL)
@@ -40,9 +42,13 @@
 
 /* File Descriptor */
 
-typedef struct {
+struct fsu_readahead;
+struct fsu_writebehind;
+
+typedef struct fsu_file {
 	int fd_fd;
-        uint8_t fd_buf[8192];   /* current buffer */
+        uint8_t *fd_buf;        /* current buffer */
+        size_t fd_bufsize;      /* size of the buffer */
         size_t fd_bpos;         /* position in the buffer */
         size_t fd_fpos;         /* position in the file */
         size_t fd_last;         /* last position in the file buffered */
@@ -55,8 +61,23 @@ typedef struct {
         uint8_t fd_mode;        /* access mode */
 
         bool fd_dirty;          /* has the buffer been modified */
+        bool fd_bufown;         /* buffer to be freed with the stream */
+        int fd_bmode;           /* _IOFBF, _IOLBF or _IONBF */
+        uint8_t fd_nbuf[1];     /* buffer of unbuffered streams */
+        struct fsu_readahead *fd_ra;    /* reading ahead, if enabled */
+        int fd_radepth;         /* number of buffers read ahead */
+        struct fsu_writebehind *fd_wb;  /* writing behind, if enabled */
+        size_t fd_wblimit;      /* bytes written behind at most */
+        int fd_wbflags;         /* FSU_WB_* */
+        LIST_ENTRY(fsu_file) fd_link;   /* in the list of open streams */
 } FSU_FILE;
 
+#define FSU_FILE_BUFSIZE        (8192)  /* smallest default buffer */
+#define FSU_FILE_RADEPTH        (2)     /* default buffers read ahead */
+#define FSU_FILE_WBLIMIT        (4 * 1024 * 1024)
+
+#define FSU_WB_FSYNC            (0x1)   /* fsync at close */
+
 /* Directory descriptor */
 typedef struct {
 	int dd_fd;
@@ -68,9 +89,11 @@ typedef struct {
 
 /* Files */
 FSU_FILE        *fsu_fopen(const char *, const char *);
+FSU_FILE        *fsu_fdopen(int, const char *);
 char            fsu_fgetc(FSU_FILE *);
 int             fsu_fputc(int, FSU_FILE *);
-void            fsu_fclose(FSU_FILE *);
+int             fsu_fclose(FSU_FILE *);
+void            fsu_fcloseall(void);
 void            fsu_rewind(FSU_FILE *);
 bool            fsu_feof(FSU_FILE *);
 void            fsu_clearerr(FSU_FILE *);
@@ -82,6 +105,14 @@ int		fsu_fseek(FSU_FILE *, long, int);
 int		fsu_fseeko(FSU_FILE *, off_t, int);
 long int	fsu_ftell(FSU_FILE *);
 off_t		fsu_ftello(FSU_FILE *);
+int		fsu_setvbuf(FSU_FILE *, char *, int, size_t);
+void		fsu_setbuffer(FSU_FILE *, char *, int);
+int		fsu_writebehind(FSU_FILE *, size_t, int);
+int		fsu_fileno(FSU_FILE *);
+ssize_t		fsu_pread(FSU_FILE *, void *, size_t, off_t);
+ssize_t		fsu_pwrite(FSU_FILE *, const void *, size_t, off_t);
+ssize_t		fsu_preadv(FSU_FILE *, const struct iovec *, int, off_t);
+ssize_t		fsu_pwritev(FSU_FILE *, const struct iovec *, int, off_t);
 
 /* Directory */
 FSU_DIR         *fsu_opendir(const char *);
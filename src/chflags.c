@@ -85,7 +85,7 @@ main(int argc, char *argv[])
 	int (*change_flags)(const char *, u_long);
 
         setprogname(argv[0]);
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	Hflag = Lflag = Rflag = hflag = 0;
@@ -148,6 +148,9 @@ main(int argc, char *argv[])
 		oct = 0;
 	}
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if ((ftsp = fts_open(++argv, fts_options, NULL)) == NULL)
 		err(1, "fts_open");
 
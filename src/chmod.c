@@ -110,7 +110,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	Hflag = Lflag = Rflag = fflag = hflag = 0;
@@ -193,6 +193,9 @@ done:	argv += optind;
 		/* NOTREACHED */
 	}
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if ((ftsp = fts_open(++argv, fts_options, 0)) == NULL) {
 		err(EXIT_FAILURE, "fts_open");
 		/* NOTREACHED */
@@ -113,9 +113,12 @@ main(int argc, char **argv)
 	(void)setlocale(LC_ALL, "");
 
 	myname = (cp = strrchr(*argv, '/')) ? cp + 1 : *argv;
-	ischown = (myname[6] == 'o' || myname[2] == 'o');
+	cp = myname;
+	if (strncmp(cp, "fsu_", 4) == 0)
+		cp += 4;
+	ischown = strcmp(cp, "chown") == 0;
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	Hflag = Lflag = Rflag = fflag = hflag = vflag = 0;
@@ -195,6 +198,9 @@ main(int argc, char **argv)
 	} else
 		a_gid(*argv);
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if ((ftsp = fts_open(++argv, fts_options, NULL)) == NULL)
 		err(EXIT_FAILURE, "fts_open");
 
@@ -124,7 +124,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	Hflag = Lflag = Pflag = Rflag = 0;
@@ -223,6 +223,9 @@ main(int argc, char *argv[])
 	/* Set end of argument list for fts(3). */
 	argv[argc] = NULL;
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	/*
 	 * Cp has two distinct cases:
 	 *
@@ -101,7 +101,7 @@ main(int argc, char *argv[])
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
 	Hflag = Lflag = aflag = cflag = dflag = gkmflag = nflag = sflag = 0;
@@ -209,6 +209,9 @@ main(int argc, char *argv[])
 		(void)getbsize(NULL, &blocksize);
 	blocksize /= 512;
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if ((fts = fts_open(argv, ftsoptions, NULL)) == NULL)
 		err(1, "fts_open `%s'", *argv);
 
@@ -91,7 +91,7 @@ main(int argc, char *argv[])
 	(void)setlocale(LC_ALL, "");
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
 	/* array to hold dir list.  at most (argc - 1) elements. */
@@ -162,6 +162,9 @@ main(int argc, char *argv[])
 
 	*p = NULL;
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if ((dotfd = rump_sys_open(".", O_RDONLY /*| O_CLOEXEC*/, 0)) == -1)
 		err(1, ".");
 
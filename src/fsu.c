@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * All of the utilities in a single binary.  The utility is picked from
+ * the name the binary is run as (fsu_ls, ls) or from the first argument
+ * (fsu ls ...).  With -b the image is mounted once and the commands of
+ * a script are run one after the other against it.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fsu_utils.h>
+#include <fsu_fts.h>
+#include <fsu_mount.h>
+
+#define FSU_PREFIX "fsu_"
+
+typedef int (*fsu_main_t)(int, char *[]);
+
+int fsu_cat_main(int, char *[]);
+int fsu_chflags_main(int, char *[]);
+int fsu_chmod_main(int, char *[]);
+int fsu_chown_main(int, char *[]);
+int fsu_cp_main(int, char *[]);
+int fsu_df_main(int, char *[]);
+int fsu_diff_main(int, char *[]);
+int fsu_du_main(int, char *[]);
+int fsu_ecp_main(int, char *[]);
+int fsu_exec_main(int, char *[]);
+int fsu_find_main(int, char *[]);
+int fsu_ln_main(int, char *[]);
+int fsu_ls_main(int, char *[]);
+int fsu_mkdir_main(int, char *[]);
+int fsu_mkfifo_main(int, char *[]);
+int fsu_mknod_main(int, char *[]);
+int fsu_mv_main(int, char *[]);
+int fsu_rm_main(int, char *[]);
+int fsu_rmdir_main(int, char *[]);
+int fsu_stat_main(int, char *[]);
+int fsu_touch_main(int, char *[]);
+int fsu_write_main(int, char *[]);
+
+static const struct fsu_cmd_s {
+	const char *fc_name;
+	fsu_main_t fc_main;
+} fsu_cmds[] = {
+	{ "cat",	fsu_cat_main },
+	{ "chflags",	fsu_chflags_main },
+	{ "chgrp",	fsu_chown_main },
+	{ "chmod",	fsu_chmod_main },
+	{ "chown",	fsu_chown_main },
+	{ "cp",		fsu_cp_main },
+	{ "df",		fsu_df_main },
+	{ "diff",	fsu_diff_main },
+	{ "du",		fsu_du_main },
+	{ "ecp",	fsu_ecp_main },
+	{ "emv",	fsu_ecp_main },
+	{ "exec",	fsu_exec_main },
+	{ "find",	fsu_find_main },
+	{ "get",	fsu_ecp_main },
+	{ "ln",		fsu_ln_main },
+	{ "ls",		fsu_ls_main },
+	{ "mkdir",	fsu_mkdir_main },
+	{ "mkfifo",	fsu_mkfifo_main },
+	{ "mknod",	fsu_mknod_main },
+	{ "mv",		fsu_mv_main },
+	{ "put",	fsu_ecp_main },
+	{ "rm",		fsu_rm_main },
+	{ "rmdir",	fsu_rmdir_main },
+	{ "stat",	fsu_stat_main },
+	{ "touch",	fsu_touch_main },
+	{ "write",	fsu_write_main },
+	{ NULL,		NULL }
+};
+
+/* writable data of the utilities, see src/crunch.ld */
+extern char __start_fsu_data[], __stop_fsu_data[];
+
+static char *fsu_data_copy;
+static jmp_buf fsu_jmp;
+static bool fsu_jmp_set;
+static int fsu_status;
+
+void	fsu_exit(int);
+void	fsu_err(int, const char *, ...);
+void	fsu_errx(int, const char *, ...);
+
+static const struct fsu_cmd_s *fsu_lookup(const char *);
+static int	fsu_run(const struct fsu_cmd_s *, int, char *[]);
+static int	fsu_batch(const char *);
+static void	usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	const struct fsu_cmd_s *cmd;
+	const char *name;
+	char *script;
+
+	name = strrchr(argv[0], '/');
+	name = name == NULL ? argv[0] : name + 1;
+
+	cmd = fsu_lookup(name);
+	if (cmd != NULL)
+		return cmd->fc_main(argc, argv);
+
+	setprogname(argv[0]);
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "-b") != 0) {
+		cmd = fsu_lookup(argv[1]);
+		if (cmd == NULL) {
+			warnx("%s: unknown command", argv[1]);
+			usage();
+		}
+		return cmd->fc_main(argc - 1, argv + 1);
+	}
+
+	if (argc < 3)
+		usage();
+	script = argv[2];
+	argv[2] = argv[0];
+	argc -= 2;
+	argv += 2;
+
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+		usage();
+	if (argc != 1)
+		usage();
+
+	return fsu_batch(script);
+}
+
+static const struct fsu_cmd_s *
+fsu_lookup(const char *name)
+{
+	const struct fsu_cmd_s *cmd;
+
+	if (strncmp(name, FSU_PREFIX, sizeof(FSU_PREFIX) - 1) == 0)
+		name += sizeof(FSU_PREFIX) - 1;
+
+	for (cmd = fsu_cmds; cmd->fc_name != NULL; ++cmd)
+		if (strcmp(name, cmd->fc_name) == 0)
+			return cmd;
+	return NULL;
+}
+
+/*
+ * Runs the commands of script, one per line, against the image mounted
+ * by main().  Empty lines and lines starting with # are skipped.  The
+ * first command to fail ends the batch with its exit status.
+ */
+static int
+fsu_batch(const char *script)
+{
+	const struct fsu_cmd_s *cmd;
+	FILE *fp;
+	char line[LINE_MAX], *p, **cargv;
+	unsigned long lineno;
+	size_t len;
+	int cargc, n, rv;
+
+	if (strcmp(script, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(script, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", script);
+
+	/* keep the pristine data of the utilities to reset them */
+	len = __stop_fsu_data - __start_fsu_data;
+	fsu_data_copy = malloc(len);
+	if (fsu_data_copy == NULL)
+		err(EXIT_FAILURE, NULL);
+	memcpy(fsu_data_copy, __start_fsu_data, len);
+
+	rv = 0;
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; ++lineno) {
+		for (p = line; *p == ' ' || *p == '\t'; ++p)
+			continue;
+		len = strlen(p);
+		if (len > 0 && p[len - 1] == '\n')
+			p[--len] = '\0';
+		if (len == 0 || p[0] == '#')
+			continue;
+
+		n = fsu_str2argc(p);
+		cargv = malloc((n + 1) * sizeof(char *));
+		if (cargv == NULL)
+			err(EXIT_FAILURE, NULL);
+		fsu_str2arg(p, &cargc, cargv, n + 1);
+
+		cmd = fsu_lookup(cargv[0]);
+		if (cmd == NULL) {
+			warnx("%s:%lu: %s: unknown command", script, lineno,
+			    cargv[0]);
+			rv = EXIT_FAILURE;
+		} else
+			rv = fsu_run(cmd, cargc, cargv);
+		free(cargv);
+
+		if (rv != 0) {
+			warnx("%s:%lu: exit status %d", script, lineno, rv);
+			break;
+		}
+	}
+	if (ferror(fp))
+		warn("%s", script);
+	if (fp != stdin)
+		fclose(fp);
+	setprogname("fsu");
+
+	return rv;
+}
+
+/*
+ * Runs one command of a batch with the utilities as they were at
+ * startup, in a rump process of its own.  exit() and err() from the
+ * utility come back here, and what it left open is closed.
+ */
+static int
+fsu_run(const struct fsu_cmd_s *cmd, int argc, char *argv[])
+{
+	struct fsu_ctx *ctx;
+
+	ctx = fsu_proc_open();
+	if (ctx == NULL) {
+		warn("%s", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memcpy(__start_fsu_data, fsu_data_copy,
+	    __stop_fsu_data - __start_fsu_data);
+	optind = 1;
+#ifdef HAVE_GETOPT_OPTRESET
+	optreset = 1;
+#endif
+	opterr = 1;
+
+	if (setjmp(fsu_jmp) == 0) {
+		fsu_jmp_set = true;
+		fsu_status = cmd->fc_main(argc, argv);
+	}
+	fsu_jmp_set = false;
+	fflush(stdout);
+
+	fsu_fcloseall();
+	fsu_fts_closeall();
+	fsu_ctx_close(ctx);
+
+	return fsu_status;
+}
+
+void
+fsu_exit(int status)
+{
+
+	if (!fsu_jmp_set)
+		exit(status);
+	fsu_status = status;
+	longjmp(fsu_jmp, 1);
+}
+
+void
+fsu_err(int eval, const char *fmt, ...)
+{
+	va_list ap;
+	int sverrno;
+
+	sverrno = errno;
+	fprintf(stderr, "%s: ", getprogname());
+	if (fmt != NULL) {
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fprintf(stderr, ": ");
+	}
+	fprintf(stderr, "%s\n", strerror(sverrno));
+	fsu_exit(eval);
+}
+
+void
+fsu_errx(int eval, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: ", getprogname());
+	if (fmt != NULL) {
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+	}
+	fprintf(stderr, "\n");
+	fsu_exit(eval);
+}
+
+static void
+usage(void)
+{
+	const struct fsu_cmd_s *cmd;
+
+	fprintf(stderr, "usage: %s command [args ...]\n"
+		"       %s -b script %s\n"
+		"commands:", getprogname(), getprogname(), fsu_mount_usage());
+	for (cmd = fsu_cmds; cmd->fc_name != NULL; ++cmd)
+		fprintf(stderr, " %s", cmd->fc_name);
+	fprintf(stderr, "\n");
+
+	exit(EXIT_FAILURE);
+}
@@ -68,13 +68,16 @@ main(int argc, char *argv[])
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
 	flags = fsu_cat_parse_arg(&argc, &argv);
 	if (argc < 1)
 		usage();
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	for (rv = 0, cur_arg = 0; cur_arg < argc; ++cur_arg)
 		rv |= fsu_cat(argv[cur_arg], flags);
 
@@ -102,7 +102,9 @@ static void	 prthuman(struct nbstatvfs *, int64_t, int64_t);
 
 static int	 gflag, hflag, iflag, nflag, Pflag;
 static long	 usize;
+#ifndef FSU_RUMPCLIENT
 extern int rump_i_know_what_i_am_doing_with_sysents;
+#endif
 
 int
 main(int argc, char *argv[])
@@ -113,12 +115,9 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
-	rump_i_know_what_i_am_doing_with_sysents = 1;
-	rump_pub_lwproc_sysent_usenative();
-
 	while ((ch = getopt(argc, argv, "aGghiklmnPt:")) != -1)
 		switch (ch) {
 		case 'a':
@@ -180,6 +179,14 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (fsu_mount_now() != 0)
+		usage();
+
+#ifndef FSU_RUMPCLIENT
+	rump_i_know_what_i_am_doing_with_sysents = 1;
+	rump_pub_lwproc_sysent_usenative();
+#endif
+
 	if (rump_sys_statvfs1("/",
 	    (struct statvfs *)&mntbuf, RUMP_MNT_WAIT) == -1)
 		errx(1, "statvfs failed: %d", errno);
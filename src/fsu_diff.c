@@ -66,7 +66,7 @@ main(int argc, char *argv[])
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
 	if (argc != 3) {
@@ -74,6 +74,9 @@ main(int argc, char *argv[])
 		/* NOTREACHED */
 	}
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	rv = fsu_diff(argv[1], argv[2]);
 
 	return rv != 0;
@@ -79,6 +79,7 @@ static int copy_to_file(const char *, struct stat *,
 			const char *, int);
 static int fsu_ecp(const char *, const char *, int);
 static int fsu_ecp_parse_arg(int *, char ***);
+static int fsu_ecp_host_check(int, char **, int);
 static void usage(void);
 
 struct hardlink_s {
@@ -95,7 +96,7 @@ main(int argc, char *argv[])
 	int cur_arg, flags, rv;
 
 	setprogname(argv[0]);
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	flags = fsu_ecp_parse_arg(&argc, &argv);
@@ -104,19 +105,78 @@ main(int argc, char *argv[])
 		return -1;
 	}
 
-        umask (0);
-        rump_sys_umask (0);
-
-	for (rv = 0, cur_arg = 0; cur_arg < argc-1; ++cur_arg) {
+	for (cur_arg = 0; cur_arg < argc-1; ++cur_arg) {
 		len = strlen(argv[cur_arg]);
 		while (len != 1 && argv[cur_arg][len - 1] == '/')
 			argv[cur_arg][--len] = '\0';
+	}
+
+	/* nothing to copy, the image is left alone */
+	rv = fsu_ecp_host_check(argc, argv, flags);
+	if (rv == 1)
+		return -1;
+
+	if (fsu_mount_now() != 0)
+		usage();
+
+        umask (0);
+        rump_sys_umask (0);
+
+	for (cur_arg = 0; cur_arg < argc-1; ++cur_arg) {
+		if (argv[cur_arg] == NULL)
+			continue;
 		rv |= fsu_ecp(argv[cur_arg], argv[argc-1], flags);
 	}
 
 	return rv;
 }
 
+/*
+ * Checks the host side of the copy before the image is mounted: the
+ * sources of a put, the sources missing are dropped from argv, and the
+ * directory a get writes into.
+ * Returns -1 if some sources are missing, 1 if there is nothing to do.
+ */
+static int
+fsu_ecp_host_check(int argc, char **argv, int flags)
+{
+	char dir[PATH_MAX], *p;
+	struct stat sb;
+	int i, left, rv;
+
+	rv = 0;
+	if (flags & FSU_ECP_PUT) {
+		for (i = left = 0; i < argc-1; ++i) {
+			if (lstat(argv[i], &sb) == -1) {
+				warn("%s", argv[i]);
+				argv[i] = NULL;
+				rv = -1;
+			} else
+				++left;
+		}
+		return left == 0 ? 1 : rv;
+	}
+
+	/* a get creates to, unless it exists, in its parent */
+	if (stat(argv[argc-1], &sb) == 0)
+		return 0;
+	if (strlcpy(dir, argv[argc-1], sizeof(dir)) >= sizeof(dir)) {
+		warnx("%s: %s", argv[argc-1], strerror(ENAMETOOLONG));
+		return 1;
+	}
+	p = strrchr(dir, '/');
+	if (p == NULL)
+		return 0;
+	if (p == dir)
+		++p;
+	*p = '\0';
+	if (stat(dir, &sb) == -1) {
+		warn("%s", dir);
+		return 1;
+	}
+	return 0;
+}
+
 static int
 fsu_ecp_parse_arg(int *argc, char ***argv)
 {
@@ -131,7 +191,8 @@ fsu_ecp_parse_arg(int *argc, char ***argv)
 	else if (strcmp(progname, "put") == 0 ||
 		 strcmp(progname, "fsu_put") == 0)
 		flags |= FSU_ECP_PUT;
-	else if (strcmp(progname, "fsu_emv") == 0)
+	else if (strcmp(progname, "emv") == 0 ||
+		 strcmp(progname, "fsu_emv") == 0)
 		flags |= FSU_ECP_DELETE;
 
 	while ((rv = getopt(*argc, *argv, "dgLpRv")) != -1) {
@@ -72,7 +72,7 @@ main(int argc, char **argv)
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	if (argc < 3)
@@ -92,6 +92,9 @@ main(int argc, char **argv)
 	if (stat(tmpfname, &sb) == 0)
 		unlink(tmpfname);
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	copy_file(from, tmpfname, true);
 
 	child = fork();
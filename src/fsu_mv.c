@@ -69,7 +69,7 @@ main(int argc, char *argv[])
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	flags = fsu_mv_parse_arg(&argc, &argv);
@@ -78,6 +78,9 @@ main(int argc, char *argv[])
 		return -1;
 	}
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	for (rv = 0, cur_arg = 0; cur_arg < argc-1; cur_arg++)
 		rv |= fsu_mv(argv[cur_arg], argv[argc-1], flags);
 
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2026 The fs-utils contributors.  All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Keeps a file system image mounted and serves it to utilities built
+ * with --enable-rumpclient, so that they do not have to boot a rump
+ * kernel and mount the image on every invocation.
+ */
+
+#include "fs-utils.h"
+
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rump.h>
+
+#include <fsu_mount.h>
+
+static int	sigpipe[2];
+
+static void	sighandler(int);
+static void	usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	char ch, *url;
+	size_t len;
+	pid_t pid;
+	int rv, status, ready[2], nullfd;
+
+	setprogname(argv[0]);
+
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
+		usage();
+
+	if (argc != 2)
+		usage();
+
+	/* a plain path is a local socket */
+	if (strstr(argv[1], "://") == NULL) {
+		len = strlen(argv[1]) + sizeof("unix://");
+		url = malloc(len);
+		if (url == NULL)
+			err(EXIT_FAILURE, NULL);
+		snprintf(url, len, "unix://%s", argv[1]);
+	} else
+		url = argv[1];
+
+	/*
+	 * The server runs in a child, in the background, and the parent
+	 * prints FSU_SESSION once it is up and exits, so that the output
+	 * can be evaluated by the shell.  The rump kernel does not survive
+	 * a fork, it is booted in the child.
+	 */
+	if (pipe(ready) == -1)
+		err(EXIT_FAILURE, "pipe");
+	fflush(stdout);
+	switch (pid = fork()) {
+	case -1:
+		err(EXIT_FAILURE, "fork");
+		/* NOTREACHED */
+	case 0:
+		break;
+	default:
+		close(ready[1]);
+		if (read(ready[0], &ch, 1) != 1) {
+			/* the child told why on the standard error */
+			waitpid(pid, &status, 0);
+			exit(EXIT_FAILURE);
+		}
+		printf("FSU_SESSION=%s; export FSU_SESSION\n", url);
+		return EXIT_SUCCESS;
+	}
+
+	close(ready[0]);
+	setsid();
+	if ((nullfd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(nullfd, STDIN_FILENO);
+		dup2(nullfd, STDOUT_FILENO);
+		if (nullfd > STDERR_FILENO)
+			close(nullfd);
+	}
+
+	/*
+	 * The rump kernel threads may take the signal, so have the
+	 * handler wake us up through a pipe.
+	 */
+	if (pipe(sigpipe) == -1)
+		err(EXIT_FAILURE, "pipe");
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (fsu_mount_now() != 0)
+		exit(EXIT_FAILURE);
+
+	rv = rump_init_server(url);
+	if (rv != 0)
+		errx(EXIT_FAILURE, "%s: %s", url, strerror(rv));
+
+	ch = 0;
+	if (write(ready[1], &ch, 1) != 1)
+		err(EXIT_FAILURE, "write");
+	close(ready[1]);
+
+	/* the image is unmounted by the atexit handler of fsu_mount */
+	while (read(sigpipe[0], &ch, 1) == -1 && errno == EINTR)
+		continue;
+	return EXIT_SUCCESS;
+}
+
+static void
+sighandler(int sig)
+{
+	char ch;
+
+	ch = sig;
+	if (write(sigpipe[1], &ch, 1) == -1)
+		return;		/* a signal is already pending */
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s %s socket\n",
+		getprogname(), fsu_mount_usage());
+
+	exit(EXIT_FAILURE);
+}
@@ -221,7 +221,7 @@ main(int argc, char *argv[])
 		synopsis = "[-FlLnqrsx] [-f format] [-t timefmt] [file ...]";
 	}
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage(synopsis);
 
 	while ((ch = getopt(argc, argv, options)) != -1)
@@ -313,6 +313,9 @@ main(int argc, char *argv[])
 	if (timefmt == NULL)
 		timefmt = TIME_FORMAT;
 
+	if (fsu_mount_now() != 0)
+		usage(synopsis);
+
 	errs = 0;
 	do {
 		if (argc == 0)
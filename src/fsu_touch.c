@@ -91,7 +91,7 @@ main(int argc, char *argv[])
 
 	ttime = rtime = NULL;
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	flags = fsu_touch_parse_arg(&argc, &argv, &rtime, &ttime);
@@ -100,6 +100,9 @@ main(int argc, char *argv[])
 		return -1;
 	}
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	for (rv = 0, cur_arg = 0; cur_arg < argc; ++cur_arg)
 		rv |= fsu_touch(argv[cur_arg], rtime, ttime, flags);
 
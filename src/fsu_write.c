@@ -37,6 +37,7 @@
 #include <unistd.h>
 
 #include <fsu_mount.h>
+#include <fsu_utils.h>
 
 #include <rump/rump_syscalls.h>
 
@@ -50,7 +51,7 @@ main(int argc, char *argv[])
 
 	setprogname(argv[0]);
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		usage();
 
 	append = 0;
@@ -70,18 +71,26 @@ main(int argc, char *argv[])
 	if (optind >= argc)
 		usage();
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	rv = fsu_write(STDIN_FILENO, argv[optind], append);
 
 	return rv != 0;
 }
 
+/*
+ * Copies fd to fname.  The image is written behind by another thread,
+ * unless FSU_WRITEBEHIND says otherwise, so that reading fd does not
+ * wait for it.
+ */
 int
 fsu_write(int fd, const char *fname, int append)
 {
-	int rd, wr;
-	size_t total;
+	FSU_FILE *file;
+	ssize_t rd;
 	uint8_t buf[8192];
-	int fdout;
+	int fdout, rv;
 
 	if (fname == NULL)
 		return -1;
@@ -92,24 +101,39 @@ fsu_write(int fd, const char *fname, int append)
 		warn("open %s", fname);
 		return -1;
 	}
+	file = fsu_fdopen(fdout, append ? "a+" : "r+");
+	if (file == NULL) {
+		warn("%s", fname);
+		rump_sys_close(fdout);
+		return -1;
+	}
+	if (getenv("FSU_WRITEBEHIND") == NULL)
+		fsu_writebehind(file, FSU_FILE_WBLIMIT, 0);
 
-	total = 0;
-	do {
+	rv = 0;
+	for (;;) {
 		rd = read(fd, buf, sizeof(buf));
 		if (rd == -1) {
 			warn("read");
+			rv = -1;
 			break;
 		}
-		wr = rump_sys_write(fdout, buf, rd);
-		if (wr == -1 || wr != rd) {
-			warn("write %s %d", fname, fdout);
+		if (rd == 0)
+			break;
+		if (fsu_fwrite(buf, 1, rd, file) != (size_t)rd) {
+			errno = fsu_ferror(file);
+			warn("write %s", fname);
+			rv = -1;
 			break;
 		}
-		total += wr;
-	} while (rd > 0 && errno != ENOSPC);
+	}
 
-	rump_sys_close(fdout);
-	return total;
+	/* errors of the writes behind show here */
+	if (fsu_fclose(file) == EOF && rv == 0) {
+		warn("write %s", fname);
+		rv = -1;
+	}
+	return rv;
 }
 
 static void
@@ -95,7 +95,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	while ((ch = getopt(argc, argv, "fhinsv")) != -1)
@@ -135,6 +135,9 @@ main(int argc, char *argv[])
 		linkch = '=';
 	}
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	switch(argc) {
 	case 0:
 		usage();
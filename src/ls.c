@@ -145,7 +145,7 @@ ls_main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READONLY) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READONLY | MOUNT_DEFER) != 0)
 		usage();
 
 	/* Terminal defaults to -Cq, non-terminal defaults to -1. */
@@ -305,6 +305,9 @@ ls_main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (fsu_mount_now() != 0)
+		usage();
+
 	if (f_column || f_columnacross || f_stream) {
 		if ((p = getenv("COLUMNS")) != NULL)
 			termwidth = atoi(p);
@@ -86,7 +86,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	/*
@@ -126,6 +126,9 @@ main(int argc, char *argv[])
 		/* NOTREACHED */
 	}
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	for (exitval = EXIT_SUCCESS; *argv != NULL; ++argv) {
 #ifdef notdef
 		char *slash;
@@ -78,7 +78,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	setlocale (LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	/* The default mode is the value of the bitwise inclusive or of
@@ -108,6 +108,9 @@ main(int argc, char *argv[])
 	if (argv[0] == NULL)
 		usage();
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	for (exitval = 0; *argv; ++argv) {
 		if (mkfifo(*argv, mode) < 0) {
 			warn("%s", *argv);
@@ -104,7 +104,7 @@ main(int argc, char **argv)
 	pack = pack_native;
 
         setprogname(argv[0]);
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	while ((ch = getopt(argc, argv, "rRF:g:m:u:")) != -1) {
@@ -232,6 +232,9 @@ main(int argc, char **argv)
 		break;
 	}
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	if (modes != NULL)
 		mode = getmode(modes, mode);
 	umask(0);
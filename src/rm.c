@@ -116,7 +116,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	Pflag = rflag = 0;
@@ -159,6 +159,9 @@ main(int argc, char *argv[])
 		usage();
 	}
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	checkdot(argv);
 
 	if (*argv) {
@@ -77,7 +77,7 @@ main(int argc, char *argv[])
 	setprogname(argv[0]);
 	(void)setlocale(LC_ALL, "");
 
-	if (fsu_mount(&argc, &argv, MOUNT_READWRITE) != 0)
+	if (fsu_mount(&argc, &argv, MOUNT_READWRITE | MOUNT_DEFER) != 0)
 		errx(-1, NULL);
 
 	pflag = 0;
@@ -96,6 +96,9 @@ main(int argc, char *argv[])
 	if (argc == 0)
 		usage();
 
+	if (fsu_mount_now() != 0)
+		errx(-1, NULL);
+
 	for (errors = 0; *argv; argv++) {
 		/* We rely on the kernel to ignore trailing '/' characters. */
 		if (rmdir(*argv) < 0) {